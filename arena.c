@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>     // For memcpy, strlen
+#include "memsafe.h"
+#include "arena.h"
+
+// Round allocations up so every block is suitably aligned for any type
+#define ARENA_ALIGN (sizeof(max_align_t))
+
+static ArenaChunk *arena_new_chunk(size_t size, ArenaChunk *next) {
+    ArenaChunk *c = xmalloc(offsetof(ArenaChunk, data) + size);
+    c->next = next;
+    c->size = size;
+    c->used = 0;
+    return c;
+}
+
+// Allocate size bytes from the arena, starting a new chunk when the current one is full.
+// Oversized requests get a chunk of their own.
+void *arena_alloc(Arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (!a->head || a->head->size - a->head->used < size)
+        a->head = arena_new_chunk(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE, a->head);
+    void *p = a->head->data + a->head->used;
+    a->head->used += size;
+    return p;
+}
+
+char *arena_strndup(Arena *a, const char *s, size_t len) {
+    char *copy = arena_alloc(a, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char *arena_strdup(Arena *a, const char *s) {
+    return arena_strndup(a, s, strlen(s));
+}
+
+// Double the capacity of an array of elem_size elements held in the arena. The used
+// elements are copied across; the old block is only reclaimed with the rest of the arena.
+void *arena_grow(Arena *a, void *array, size_t used, size_t *cap, size_t elem_size) {
+    size_t new_cap = *cap ? *cap * 2 : 16;
+    void *p = arena_alloc(a, new_cap * elem_size);
+    if (used) memcpy(p, array, used * elem_size);
+    *cap = new_cap;
+    return p;
+}
+
+// Release everything allocated so far. One standard sized chunk is kept for reuse,
+// so an arena that is reset and refilled (e.g. once per directory) rarely calls malloc.
+void arena_reset(Arena *a) {
+    ArenaChunk *keep = NULL;
+    ArenaChunk *c = a->head, *next;
+    while (c) {
+        next = c->next;
+        if (!keep && c->size == ARENA_CHUNK_SIZE) {
+            keep = c;
+        } else {
+            free(c);
+        }
+        c = next;
+    }
+    if (keep) {
+        keep->next = NULL;
+        keep->used = 0;
+    }
+    a->head = keep;
+}
+
+// Free all chunks, including the one kept by arena_reset()
+void arena_free(Arena *a) {
+    ArenaChunk *c = a->head, *next;
+    while (c) {
+        next = c->next;
+        free(c);
+        c = next;
+    }
+    a->head = NULL;
+}
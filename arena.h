@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// -------------------- Arena (bump) allocator --------------------
+// Hands out variable-length blocks from large chunks so that the many small
+// per-directory records (subdirectory nodes, names, link targets) cost one
+// pointer bump each instead of a separate xmalloc(). Everything allocated from
+// an arena is released together by arena_reset() / arena_free().
+
+#define ARENA_CHUNK_SIZE (16 * 1024)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;   // Previously filled chunk (singly linked, newest first)
+    size_t size;               // Usable bytes in data[]
+    size_t used;               // Bytes handed out so far
+    char data[];               // Storage
+} ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk *head;          // Chunk currently being filled (NULL until first use)
+} Arena;
+
+void *arena_alloc(Arena *a, size_t size);
+char *arena_strdup(Arena *a, const char *s);
+char *arena_strndup(Arena *a, const char *s, size_t len);
+void *arena_grow(Arena *a, void *array, size_t used, size_t *cap, size_t elem_size);
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+
+#endif
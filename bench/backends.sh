@@ -0,0 +1,56 @@
+#!/bin/bash
+# Compare the readdir and io_uring scan backends on a cold page cache.
+#
+# usage: bench/backends.sh DIRECTORY [runs] [gtree options...]
+#
+# Both binaries are built in a scratch directory (the tree's own objects are left
+# alone), checked to give identical output, then timed alternately. Dropping the
+# page cache needs root; without it the runs are warm-cache only.
+
+set -e
+DIR=${1:?usage: bench/backends.sh DIRECTORY [runs] [gtree options...]}
+RUNS=${2:-5}
+shift; [ $# -gt 0 ] && shift
+OPTS=${*:--f -s}
+
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for backend in readdir uring; do
+    mkdir "$WORK/$backend"
+    cp "$SRC"/*.c "$SRC"/*.h "$SRC"/makefile "$WORK/$backend"
+    make -s -C "$WORK/$backend" SCAN_BACKEND=$backend >/dev/null
+done
+
+drop_caches() {
+    sync
+    if [ -w /proc/sys/vm/drop_caches ]; then
+        echo 3 > /proc/sys/vm/drop_caches
+    else
+        COLD=" (warm cache: run as root to drop caches)"
+    fi
+}
+
+# Same tree, same options: the output must not depend on the backend
+if ! cmp -s <("$WORK/readdir/gtree" $OPTS "$DIR" 2>&1 | grep -v '^Peak') \
+            <("$WORK/uring/gtree" $OPTS "$DIR" 2>&1 | grep -v '^Peak'); then
+    echo "backends disagree on $DIR" >&2
+    exit 1
+fi
+
+TIMEFORMAT=%R
+for ((i = 1; i <= RUNS; i++)); do
+    for backend in readdir uring; do
+        drop_caches
+        t=$( { time "$WORK/$backend/gtree" $OPTS "$DIR" >/dev/null 2>&1; } 2>&1 )
+        echo "$backend $t" >> "$WORK/times"
+    done
+done
+
+echo "gtree $OPTS $DIR, $RUNS runs each${COLD}"
+for backend in readdir uring; do
+    grep "^$backend " "$WORK/times" | sort -k2 -n | awk -v b=$backend '
+        { t[NR] = $2; sum += $2 }
+        END { printf "  %-8s min %.3fs  median %.3fs  mean %.3fs\n", b, t[1], t[int((NR + 1) / 2)], sum / NR }'
+done
@@ -0,0 +1,67 @@
+#!/bin/bash
+# Compare build profiles: the old unoptimised build, -O2, -O3, -O2 with LTO (the
+# release target), the PGO build and, optionally, -march variants.
+#
+# usage: bench/builds.sh DIRECTORY [runs] [gtree options...]
+#
+# Every profile is built in its own scratch directory (the tree's own objects are
+# left alone), checked to give identical output, then timed alternately on a warm
+# cache; gtree is mostly waiting on system calls, so the user CPU time shows what
+# the compiler changed. MARCHES="x86-64-v3 native" adds release builds with those
+# -march values.
+
+set -e
+DIR=${1:?usage: bench/builds.sh DIRECTORY [runs] [gtree options...]}
+RUNS=${2:-5}
+shift; [ $# -gt 0 ] && shift
+OPTS=${*:--f -s}
+
+SRC=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+build() {   # name, make arguments...
+    local name=$1; shift
+    mkdir -p "$WORK/$name/bench"
+    cp "$SRC"/*.c "$SRC"/*.h "$SRC"/makefile "$WORK/$name"
+    cp "$SRC"/bench/*.c "$WORK/$name/bench"
+    make -s -C "$WORK/$name" "$@" >/dev/null 2>&1 || { echo "build $name failed" >&2; exit 1; }
+    BUILDS="$BUILDS $name"
+}
+
+build O0 gtree CFLAGS=
+build O2 gtree CFLAGS=-O2
+build O3 gtree CFLAGS=-O3
+build release release
+build pgo pgo PGO_TREE="$WORK/pgo-tree"
+for m in $MARCHES; do
+    build "march=$m" release MARCH=$m
+done
+
+# Same tree, same options: the output must not depend on the build
+for b in $BUILDS; do
+    if ! cmp -s <("$WORK/O0/gtree" $OPTS "$DIR" 2>&1 | grep -v '^Peak') \
+                <("$WORK/$b/gtree" $OPTS "$DIR" 2>&1 | grep -v '^Peak'); then
+        echo "build $b disagrees on $DIR" >&2
+        exit 1
+    fi
+done
+
+TIMEFORMAT='%R %U'
+for ((i = 1; i <= RUNS; i++)); do
+    for b in $BUILDS; do
+        t=$( { time "$WORK/$b/gtree" $OPTS "$DIR" >/dev/null 2>&1; } 2>&1 )
+        echo "$b $t" >> "$WORK/times"
+    done
+done
+
+median() { sort -n | awk '{ t[NR] = $1 } END { print t[int((NR + 1) / 2)] }'; }
+
+echo "gtree $OPTS $DIR, median of $RUNS warm runs each"
+base=$(grep "^O0 " "$WORK/times" | awk '{ print $3 }' | median)
+for b in $BUILDS; do
+    real=$(grep "^$b " "$WORK/times" | awk '{ print $2 }' | median)
+    user=$(grep "^$b " "$WORK/times" | awk '{ print $3 }' | median)
+    awk -v b=$b -v r=$real -v u=$user -v u0=$base 'BEGIN {
+        printf "  %-18s wall %.3fs  user %.3fs (%+.0f%%)\n", b, r, u, (u0 > 0 ? (u - u0) * 100 / u0 : 0) }'
+done
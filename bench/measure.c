@@ -0,0 +1,56 @@
+// Runs a command and reports its wall time and peak RSS, for bench/run.sh
+//
+// usage: measure OUTFILE command [args...]
+// The command's stdout and stderr go to OUTFILE; "seconds peak_rss_kb" is printed
+// on stdout. Exits with the command's status.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>          // For open
+#include <time.h>           // For clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>         // For fork, execvp, dup2
+#include <sys/resource.h>   // For struct rusage
+#include <sys/wait.h>       // For wait4
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        fprintf(stderr, "usage: measure OUTFILE command [args...]\n");
+        return EXIT_FAILURE;
+    }
+    int out = open(argv[1], O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out == -1) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        return EXIT_FAILURE;
+    }
+    if (pid == 0) {
+        dup2(out, STDOUT_FILENO);
+        dup2(out, STDERR_FILENO);
+        execvp(argv[2], argv + 2);
+        perror(argv[2]);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) == -1) {
+        perror("wait4");
+        return EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+#ifdef __APPLE__
+    long rss_kb = ru.ru_maxrss / 1024;      // bytes on macOS
+#else
+    long rss_kb = ru.ru_maxrss;             // kilobytes on Linux
+#endif
+    printf("%.6f %ld\n", (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9, rss_kb);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
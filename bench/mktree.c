@@ -0,0 +1,162 @@
+// Synthetic directory trees for bench/run.sh
+//
+// usage: mktree [options] DIR
+//   -b N   fan-out: subdirectories per directory (default 4)
+//   -d N   depth of the full tree below DIR (default 3)
+//   -f N   files per directory (default 10)
+//   -z N   size of each file in bytes, sparse (default 0)
+//   -n N   length of every entry name, at least 6 (default 8)
+//   -s P   percent of directories that get a symlink to a sibling directory (default 0)
+//   -l P   percent of directories that get a symlink back to an ancestor, a loop (default 0)
+//   -D N   also add a chain of N nested directories (e.g. 1030 to pass MAX_DEPTH)
+//   -r N   seed for where links go (default 1): the same options give the same tree
+//
+// Everything is created relative to directory fds, so neither the depth of the
+// chain nor PATH_MAX limits the tree. DIR must not exist yet.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>      // For openat, O_DIRECTORY
+#include <unistd.h>     // For getopt, symlinkat, ftruncate, close
+#include <sys/stat.h>   // For mkdirat
+
+typedef struct {
+    int fanout, depth, files, name_len, sym_pct, loop_pct, chain;
+    off_t file_size;
+    uint64_t rng;
+    size_t dirs, nfiles, links;     // created so far
+} Shape;
+
+static void die(const char *what, const char *name) {
+    fprintf(stderr, "mktree: %s %s: %s\n", what, name, strerror(errno));
+    exit(EXIT_FAILURE);
+}
+
+// splitmix64: plenty for deciding where links go
+static unsigned rnd_pct(Shape *s) {
+    uint64_t z = (s->rng += 0x9e3779b97f4a7c15u);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    return (unsigned)((z ^ (z >> 31)) % 100);
+}
+
+// "d" or "f" or "l", the index, then 'x' padding up to name_len
+static void make_name(char *out, const Shape *s, char kind, int i) {
+    int n = snprintf(out, 64, "%c%05d", kind, i);
+    while (n < s->name_len) out[n++] = 'x';
+    out[n] = '\0';
+}
+
+static int mkdir_open(int dfd, const char *name) {
+    if (mkdirat(dfd, name, 0755) == -1) die("mkdir", name);
+    int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) die("open", name);
+    return fd;
+}
+
+static void add_files(int dfd, Shape *s) {
+    char name[64];
+    for (int i = 0; i < s->files; i++) {
+        make_name(name, s, 'f', i);
+        int fd = openat(dfd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd == -1) die("create", name);
+        if (s->file_size && ftruncate(fd, s->file_size) == -1) die("truncate", name);
+        close(fd);
+        s->nfiles++;
+    }
+}
+
+static void add_link(int dfd, Shape *s, const char *target) {
+    char name[64];
+    make_name(name, s, 'l', 0);
+    if (symlinkat(target, dfd, name) == -1) die("symlink", name);
+    s->links++;
+}
+
+// The directory open on dfd, level levels below DIR: its files, links and subtree
+static void fill(int dfd, int level, Shape *s) {
+    char name[64];
+    add_files(dfd, s);
+
+    if (level > 0 && s->fanout > 1 && rnd_pct(s) < (unsigned)s->sym_pct) {
+        char target[80];
+        make_name(name, s, 'd', (int)(rnd_pct(s) % (unsigned)s->fanout));
+        snprintf(target, sizeof(target), "../%s", name);
+        add_link(dfd, s, target);
+    } else if (level > 0 && rnd_pct(s) < (unsigned)s->loop_pct) {
+        char target[3 * 64 + 1] = "..";
+        for (int up = (int)(rnd_pct(s) % (unsigned)level); up > 0 && strlen(target) < 3 * 63; up--)
+            strcat(target, "/..");
+        add_link(dfd, s, target);
+    }
+
+    if (level == s->depth) return;
+    for (int i = 0; i < s->fanout; i++) {
+        make_name(name, s, 'd', i);
+        int fd = mkdir_open(dfd, name);
+        s->dirs++;
+        fill(fd, level + 1, s);
+        close(fd);
+    }
+}
+
+static int arg(const char *opt, const char *val, int min) {
+    int n = atoi(val);
+    if (n < min) {
+        fprintf(stderr, "mktree: -%s must be at least %d\n", opt, min);
+        exit(EXIT_FAILURE);
+    }
+    return n;
+}
+
+int main(int argc, char *argv[]) {
+    Shape s = { .fanout = 4, .depth = 3, .files = 10, .name_len = 8, .rng = 1 };
+    int opt;
+    while ((opt = getopt(argc, argv, "b:d:f:z:n:s:l:D:r:")) != -1) {
+        switch (opt) {
+            case 'b': s.fanout = arg("b", optarg, 0); break;
+            case 'd': s.depth = arg("d", optarg, 0); break;
+            case 'f': s.files = arg("f", optarg, 0); break;
+            case 'z': s.file_size = arg("z", optarg, 0); break;
+            case 'n': s.name_len = arg("n", optarg, 6); break;
+            case 's': s.sym_pct = arg("s", optarg, 0); break;
+            case 'l': s.loop_pct = arg("l", optarg, 0); break;
+            case 'D': s.chain = arg("D", optarg, 0); break;
+            case 'r': s.rng = (uint64_t)arg("r", optarg, 0); break;
+            default:
+                fprintf(stderr, "usage: mktree [-b fanout] [-d depth] [-f files] [-z size] [-n name_len]\n"
+                                "              [-s sym%%] [-l loop%%] [-D chain] [-r seed] DIR\n");
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "mktree: one directory to create is needed\n");
+        return EXIT_FAILURE;
+    }
+    if (s.name_len > 63) s.name_len = 63;
+
+    int root = mkdir_open(AT_FDCWD, argv[optind]);
+    s.dirs++;
+    fill(root, 0, &s);
+
+    // The chain hangs off the root, one directory (and its files) per level
+    int fd = root;
+    char name[64];
+    make_name(name, &s, 'c', 0);
+    for (int i = 0; i < s.chain; i++) {
+        int next = mkdir_open(fd, name);
+        if (fd != root) close(fd);
+        fd = next;
+        s.dirs++;
+        add_files(fd, &s);
+    }
+    if (fd != root) close(fd);
+    close(root);
+
+    printf("%s: %zu directories, %zu files, %zu symlinks\n", argv[optind], s.dirs, s.nfiles, s.links);
+    return 0;
+}
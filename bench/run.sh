@@ -0,0 +1,67 @@
+#!/bin/bash
+# Time gtree in each mode on a synthetic tree, hot and cold cache.
+#
+# usage: bench/run.sh GTREE TREE [runs] [mktree options...]
+#
+# TREE is generated with bench/mktree and the given options unless it already
+# exists (delete it to change the shape). For every mode the table shows the
+# entries printed, the median wall time of the runs and entries/sec, the file
+# system calls per entry (counted by a separate --timing run: opendir, readdir,
+# lstat, stat and readlink; readdir counts library calls, not getdents), the
+# peak RSS and the peak directory fds gtree reports. Cold runs drop the page
+# cache first, which needs root. `make bench` builds everything and runs this.
+
+set -e
+GTREE=${1:?usage: bench/run.sh GTREE TREE [runs] [mktree options...]}
+TREE=${2:?usage: bench/run.sh GTREE TREE [runs] [mktree options...]}
+RUNS=${3:-5}
+shift 2; [ $# -gt 0 ] && shift
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+for tool in mktree measure; do
+    [ -x "$BENCH/$tool" ] || { echo "bench/$tool is missing: run make bench" >&2; exit 1; }
+done
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+[ -e "$TREE" ] || "$BENCH/mktree" "$@" "$TREE"
+
+can_drop() { [ -w /proc/sys/vm/drop_caches ]; }
+drop_caches() { sync; echo 3 > /proc/sys/vm/drop_caches; }
+
+# Lines of the tree itself: the summary follows the first empty line
+entries() { awk '/^$/ { exit } { n++ } END { print n + 0 }' "$1"; }
+calls() { awk '/^Time in file system calls:/ { on = 1; getline; next }
+               on && /^$/ { exit }
+               on { n += $2 } END { print n + 0 }' "$1"; }
+peak_fds() { sed -n 's/^Peak directory fds held open: \([0-9]*\).*/\1/p' "$1"; }
+
+# measure each run of one mode; prints "median_seconds max_rss_kb"
+timed_runs() {
+    local cache=$1; shift
+    for ((i = 1; i <= RUNS; i++)); do
+        [ "$cache" = cold ] && drop_caches
+        "$BENCH/measure" "$WORK/out" "$GTREE" "$@" "$TREE"
+    done | sort -n | awk '{ t[NR] = $1; if ($2 > rss) rss = $2 }
+                          END { print t[int((NR + 1) / 2)], rss }'
+}
+
+CACHES="hot"
+if can_drop; then CACHES="hot cold"; else NOTE="cold cache skipped: dropping the cache needs root"; fi
+
+echo "gtree $("$GTREE" -v 2>&1 | sed 's/.*: //') on $TREE, median of $RUNS runs"
+[ -n "$NOTE" ] && echo "($NOTE)"
+printf "%-8s %-5s %9s %9s %11s %11s %9s %8s\n" \
+    mode cache entries seconds entries/s calls/entry "RSS KB" "peak fds"
+for mode in "" "-f" "-s" "-l" "-j" "-d 3"; do
+    "$GTREE" $mode --timing "$TREE" > "$WORK/counted" 2>&1
+    n=$(entries "$WORK/counted")
+    c=$(calls "$WORK/counted")
+    for cache in $CACHES; do
+        [ "$cache" = hot ] && "$GTREE" $mode "$TREE" >/dev/null 2>&1   # warm up
+        read -r secs rss < <(timed_runs $cache $mode)
+        fds=$(peak_fds "$WORK/out")
+        awk -v m="${mode:-(none)}" -v k=$cache -v n=$n -v s=$secs -v c=$c -v r=$rss -v f=${fds:-0} 'BEGIN {
+            printf "%-8s %-5s %9d %9.4f %11.0f %11.2f %9d %8d\n", m, k, n, s, (s > 0 ? n / s : 0), c / n, r, f }'
+    done
+done
@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>     // For memcpy, memcmp, strlen
+#include <unistd.h>     // For fsync, unlink (POSIX)
+#include "arena.h"
+#include "checkpoint.h"
+#include "memsafe.h"
+
+#define CHECKPOINT_BYTE_ORDER 0x01020304u
+#define CHECKPOINT_END        0x454e44434b505447ull     // After the last value
+#define CHECKPOINT_STR_MAX    (1u << 20)                // Longer than any path
+
+typedef struct CheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+} CheckpointHeader;
+
+struct CheckpointFile {
+    FILE *fp;
+    char *file;                 // Destination, while writing
+    char *tmp;                  // file.tmp, while writing
+    bool bad;                   // A write failed, or the file ended or held nonsense
+};
+
+// ----------------- Writer -----------------
+CheckpointFile *checkpoint_create(const char *file) {
+    size_t len = strlen(file);
+    char *tmp = xmalloc(len + 5);
+    memcpy(tmp, file, len);
+    memcpy(tmp + len, ".tmp", 5);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror(tmp);
+        free(tmp);
+        return NULL;
+    }
+    CheckpointFile *cf = xcalloc(1, sizeof(CheckpointFile));
+    cf->fp = fp;
+    cf->tmp = tmp;
+    cf->file = xmalloc(len + 1);
+    memcpy(cf->file, file, len + 1);
+
+    CheckpointHeader hdr = {0};
+    memcpy(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic));
+    hdr.version = CHECKPOINT_VERSION;
+    hdr.byte_order = CHECKPOINT_BYTE_ORDER;
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1) cf->bad = true;
+    return cf;
+}
+
+void checkpoint_put(CheckpointFile *cf, uint64_t v) {
+    if (fwrite(&v, sizeof(v), 1, cf->fp) != 1) cf->bad = true;
+}
+
+void checkpoint_put_str(CheckpointFile *cf, const char *s) {
+    if (!s) {
+        checkpoint_put(cf, CHECKPOINT_NULL);
+        return;
+    }
+    size_t len = strlen(s);
+    checkpoint_put(cf, len);
+    if (len && fwrite(s, 1, len, cf->fp) != len) cf->bad = true;
+}
+
+static void free_file(CheckpointFile *cf) {
+    free(cf->file);
+    free(cf->tmp);
+    free(cf);
+}
+
+bool checkpoint_commit(CheckpointFile *cf) {
+    checkpoint_put(cf, CHECKPOINT_END);
+    bool ok = !cf->bad && fflush(cf->fp) == 0 && fsync(fileno(cf->fp)) == 0;
+    if (fclose(cf->fp) != 0) ok = false;
+    if (ok && rename(cf->tmp, cf->file) != 0) ok = false;
+    if (!ok) {
+        perror(cf->file);
+        unlink(cf->tmp);
+    }
+    free_file(cf);
+    return ok;
+}
+
+// ----------------- Reader -----------------
+CheckpointFile *checkpoint_open(const char *file) {
+    FILE *fp = fopen(file, "rb");
+    if (!fp) {
+        perror(file);
+        return NULL;
+    }
+    CheckpointHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, CHECKPOINT_MAGIC, sizeof(hdr.magic))
+        || hdr.version != CHECKPOINT_VERSION || hdr.byte_order != CHECKPOINT_BYTE_ORDER) {
+        fprintf(stderr, "%s: not a gtree checkpoint (or written by another version)\n", file);
+        fclose(fp);
+        return NULL;
+    }
+    CheckpointFile *cf = xcalloc(1, sizeof(CheckpointFile));
+    cf->fp = fp;
+    size_t len = strlen(file);
+    cf->file = xmalloc(len + 1);
+    memcpy(cf->file, file, len + 1);
+    return cf;
+}
+
+uint64_t checkpoint_get(CheckpointFile *cf) {
+    uint64_t v;
+    if (cf->bad || fread(&v, sizeof(v), 1, cf->fp) != 1) {
+        cf->bad = true;
+        return 0;
+    }
+    return v;
+}
+
+char *checkpoint_get_str(CheckpointFile *cf, Arena *arena) {
+    uint64_t len = checkpoint_get(cf);
+    if (len == CHECKPOINT_NULL && !cf->bad) return NULL;
+    if (len >= CHECKPOINT_STR_MAX) cf->bad = true;
+    if (cf->bad) return arena_strdup(arena, "");
+    char *s = arena_alloc(arena, (size_t)len + 1);
+    if (len && fread(s, 1, (size_t)len, cf->fp) != len) {
+        cf->bad = true;
+        len = 0;
+    }
+    s[len] = '\0';
+    return s;
+}
+
+void checkpoint_reject(CheckpointFile *cf) {
+    cf->bad = true;
+}
+
+bool checkpoint_bad(const CheckpointFile *cf) {
+    return cf->bad;
+}
+
+bool checkpoint_close(CheckpointFile *cf) {
+    bool ok = checkpoint_get(cf) == CHECKPOINT_END && !cf->bad;
+    if (!ok) fprintf(stderr, "%s: damaged gtree checkpoint\n", cf->file);
+    fclose(cf->fp);
+    free_file(cf);
+    return ok;
+}
@@ -0,0 +1,44 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+
+// -------------------- Checkpoint file format --------------------
+// A checkpoint (--checkpoint, --resume) is what a depth-first walk needs to carry on
+// between two directories: the frames on its stack with the subdirectories each has
+// left, its totals and its visited sets (walk.c decides what goes in, and in which
+// order). The file is a header followed by a stream of 64-bit integers and strings
+// (a length, or CHECKPOINT_NULL, then the bytes), closed by an end marker so a
+// truncated file is recognised. Integers are in the byte order of the writing machine.
+#define CHECKPOINT_MAGIC   "GTCKPT\0\0"
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_NULL    UINT64_MAX    // a NULL string
+
+typedef struct CheckpointFile CheckpointFile;
+
+// Writing: everything goes to file.tmp, which checkpoint_commit() syncs and renames
+// over file, so a crash at any point leaves the previous checkpoint intact. NULL
+// (after saying why on stderr) if file.tmp can't be created.
+CheckpointFile *checkpoint_create(const char *file);
+void checkpoint_put(CheckpointFile *cf, uint64_t v);
+void checkpoint_put_str(CheckpointFile *cf, const char *s);
+// Returns false (after saying why) if the checkpoint couldn't be written; frees cf
+bool checkpoint_commit(CheckpointFile *cf);
+
+// Reading: NULL (after saying why) if file can't be opened or isn't a checkpoint.
+// Once anything is missing or malformed every further value is 0 (strings ""), and
+// checkpoint_close() says so.
+CheckpointFile *checkpoint_open(const char *file);
+uint64_t checkpoint_get(CheckpointFile *cf);
+// A string copied into arena, NULL if a NULL one was written
+char *checkpoint_get_str(CheckpointFile *cf, Arena *arena);
+// Marks the checkpoint as malformed (a value out of range)
+void checkpoint_reject(CheckpointFile *cf);
+// Something was missing or malformed: stop reading
+bool checkpoint_bad(const CheckpointFile *cf);
+// Returns false (after saying why) unless everything up to the end marker was read; frees cf
+bool checkpoint_close(CheckpointFile *cf);
+
+#endif
@@ -0,0 +1,173 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>     // For strlen, strpbrk, memcpy, strcmp
+#include <fnmatch.h>    // For fnmatch (POSIX)
+#include "memsafe.h"
+#include "khashl.h"
+#include "filter.h"
+
+// Pattern strings, looked up by content
+KHASHL_SET_INIT(static kh_inline klib_unused, name_set, name_set, const char *, kh_hash_str, kh_eq_str)
+
+#define FILTER_MAX_LENGTHS 64   // distinct prefix/suffix lengths tracked per filter
+
+// The patterns of each shape; prefixes and suffixes are grouped by length, so a
+// name needs one lookup per distinct length rather than one per pattern
+typedef struct {
+    name_set *set;
+    size_t lens[FILTER_MAX_LENGTHS];
+    int nlens;
+} AffixSet;
+
+struct NameFilter {
+    name_set *exact;            // "name"
+    AffixSet suffix;            // "*suffix"
+    AffixSet prefix;            // "prefix*"
+    char **globs;               // everything else, for fnmatch()
+    size_t nglobs;
+};
+
+NameFilter *filter_create(void) {
+    NameFilter *f = xcalloc(1, sizeof(NameFilter));
+    f->exact = name_set_init();
+    f->suffix.set = name_set_init();
+    f->prefix.set = name_set_init();
+    return f;
+}
+
+static char *copy_str(const char *s, size_t len) {
+    char *p = xmalloc(len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+static void put_str(name_set *set, char *s) {
+    int absent;
+    name_set_put(set, s, &absent);
+    if (!absent) free(s);       // duplicate pattern
+}
+
+// False if the affix set already tracks too many lengths (the caller uses fnmatch())
+static bool affix_add(AffixSet *a, const char *s, size_t len) {
+    int i = 0;
+    while (i < a->nlens && a->lens[i] != len) i++;
+    if (i == a->nlens) {
+        if (a->nlens == FILTER_MAX_LENGTHS) return false;
+        a->lens[a->nlens++] = len;
+    }
+    put_str(a->set, copy_str(s, len));
+    return true;
+}
+
+void filter_add(NameFilter *f, const char *pattern) {
+    size_t len = strlen(pattern);
+    const char *meta = strpbrk(pattern, "*?[\\");
+
+    if (!meta) {
+        put_str(f->exact, copy_str(pattern, len));
+        return;
+    }
+    // A single leading or trailing '*' around a literal
+    if (meta == pattern && *meta == '*' && !strpbrk(pattern + 1, "*?[\\")
+        && affix_add(&f->suffix, pattern + 1, len - 1))
+        return;
+    if (meta == pattern + len - 1 && *meta == '*' && len > 1
+        && affix_add(&f->prefix, pattern, len - 1))
+        return;
+
+    f->globs = xrealloc(f->globs, (f->nglobs + 1) * sizeof(char *));
+    f->globs[f->nglobs++] = copy_str(pattern, len);
+}
+
+bool filter_match(const NameFilter *f, const char *name) {
+    if (!f) return false;
+    if (name_set_get(f->exact, name) != kh_end(f->exact)) return true;
+
+    size_t len = strlen(name);
+    for (int i = 0; i < f->suffix.nlens; i++) {
+        size_t l = f->suffix.lens[i];
+        if (l <= len && name_set_get(f->suffix.set, name + len - l) != kh_end(f->suffix.set))
+            return true;
+    }
+    if (f->prefix.nlens) {
+        char head[256];             // NAME_MAX is 255 on the platforms we build on
+        for (int i = 0; i < f->prefix.nlens; i++) {
+            size_t l = f->prefix.lens[i];
+            if (l > len || l >= sizeof(head)) continue;
+            memcpy(head, name, l);
+            head[l] = '\0';
+            if (name_set_get(f->prefix.set, head) != kh_end(f->prefix.set)) return true;
+        }
+    }
+
+    for (size_t i = 0; i < f->nglobs; i++)
+        if (fnmatch(f->globs[i], name, 0) == 0) return true;
+    return false;
+}
+
+// ----------------- Digest -----------------
+// Every pattern is written back in its original form ("name", "*suffix", "prefix*" or
+// the glob), and the sorted list is hashed
+static size_t collect_set(const name_set *set, const char *before, const char *after,
+                          char **out, size_t n) {
+    khint_t k;
+    kh_foreach(set, k) {
+        const char *s = kh_key(set, k);
+        size_t lb = strlen(before), ls = strlen(s), la = strlen(after);
+        char *p = xmalloc(lb + ls + la + 1);
+        memcpy(p, before, lb);
+        memcpy(p + lb, s, ls);
+        memcpy(p + lb + ls, after, la + 1);
+        out[n++] = p;
+    }
+    return n;
+}
+
+static int cmp_str(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+uint64_t filter_digest(const NameFilter *f) {
+    if (!f) return 0;
+    size_t total = kh_size(f->exact) + kh_size(f->suffix.set) + kh_size(f->prefix.set) + f->nglobs;
+    char **all = xmalloc((total ? total : 1) * sizeof(char *));
+    size_t n = collect_set(f->exact, "", "", all, 0);
+    n = collect_set(f->suffix.set, "*", "", all, n);
+    n = collect_set(f->prefix.set, "", "*", all, n);
+    for (size_t i = 0; i < f->nglobs; i++)
+        all[n++] = copy_str(f->globs[i], strlen(f->globs[i]));
+    qsort(all, n, sizeof(char *), cmp_str);
+
+    uint64_t h = 14695981039346656037ull;  // FNV-1a over the patterns, each with its NUL
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && !strcmp(all[i], all[i - 1])) {
+            free(all[i]);               // a glob added twice counts once
+            continue;
+        }
+        for (const char *p = all[i]; ; p++) {
+            h = (h ^ (unsigned char)*p) * 1099511628211ull;
+            if (!*p) break;
+        }
+        free(all[i]);
+    }
+    free(all);
+    return h;
+}
+
+static void free_set(name_set *set) {
+    khint_t k;
+    kh_foreach(set, k) free((char *)kh_key(set, k));
+    name_set_destroy(set);
+}
+
+void filter_free(NameFilter *f) {
+    if (!f) return;
+    free_set(f->exact);
+    free_set(f->suffix.set);
+    free_set(f->prefix.set);
+    for (size_t i = 0; i < f->nglobs; i++)
+        free(f->globs[i]);
+    free(f->globs);
+    free(f);
+}
@@ -0,0 +1,24 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// -------------------- Name filters (--include / --exclude) --------------------
+// A list of glob patterns (fnmatch syntax) compiled into one matcher for entry
+// names. The common shapes are answered with hash lookups instead of an
+// fnmatch() per pattern: literal names ("node_modules", ".git"), suffixes
+// ("*.o") and prefixes ("build*"). Only the other patterns run fnmatch().
+
+typedef struct NameFilter NameFilter;
+
+NameFilter *filter_create(void);
+void filter_add(NameFilter *f, const char *pattern);
+// True if name matches any pattern (a NULL filter matches nothing)
+bool filter_match(const NameFilter *f, const char *name);
+// A hash of the patterns f holds, the same whatever order they were added in and
+// however they were stored (0 for a NULL filter), for --checkpoint
+uint64_t filter_digest(const NameFilter *f);
+void filter_free(NameFilter *f);
+
+#endif
@@ -1,97 +1,567 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <dirent.h>     // For DIR, struct dirent, opendir, readdir, closedir (POSIX)
-#include <string.h>     // For strncpy, strcmp, strrchr, memset, memcpy, snprintf
-#include <sys/stat.h>   // For struct stat, lstat, stat, S_ISDIR, S_ISLNK (POSIX)
-#include <libgen.h>     // For basename if needed (not used here)
-#include <unistd.h>     // For readlink (POSIX)
-#include <inttypes.h>   // For intmax_t
+#include <stdint.h>     // For intmax_t, uintmax_t
+#include <string.h>     // For strlen, strcpy, strcmp
+#include <errno.h>      // For errno
+#include <unistd.h>     // For STDOUT_FILENO
+#include <pthread.h>    // For pthread_create, pthread_cond_wait
+#include <sys/stat.h>   // For stat
 #include "gtree.h"
-#include "visit_hash.h"
 #include "option_parsing.h"
 #include "memsafe.h"
 #include "print.h"
+#include "output.h"
+#include "progress.h"
+#include "snapshot.h"
+#include "top.h"
+#include "timing.h"
+#include "walk.h"
+#include "watch.h"
+#ifdef __linux__
+#include <sys/sysmacros.h>  // For major, minor
+#endif
+
+// ----------------- Per device totals (--devices) -----------------
+// Filled in from each directory as it is reached, from the st_dev Phase 2 already has
+typedef struct DevUsage {
+    dev_t dev;
+    char *first_dir;            // First directory reached on the device (usually where it is mounted)
+    size_t dirs;
+    size_t files;
+    off_t size;
+} DevUsage;
+
+typedef struct DevTable {
+    DevUsage *devs;             // In the order the devices were first reached
+    size_t count, cap;
+    size_t last;                // Device of the previous directory: they come in long runs
+} DevTable;
+
+// The device's entry, added if it is new: first reached at dir, or at dir/name
+static DevUsage *dev_usage(DevTable *t, dev_t dev, const char *dir, const char *name) {
+    size_t i = t->last;
+    if (i >= t->count || t->devs[i].dev != dev) {
+        for (i = 0; i < t->count && t->devs[i].dev != dev; i++)
+            ;
+        if (i == t->count) {
+            if (t->count == t->cap) {
+                t->cap = t->cap ? t->cap * 2 : 8;
+                t->devs = xrealloc(t->devs, t->cap * sizeof(DevUsage));
+            }
+            size_t len = strlen(dir);
+            char *path = xmalloc(len + (name ? strlen(name) + 2 : 1));
+            strcpy(path, dir);
+            if (name) {
+                path[len] = '/';
+                strcpy(path + len + 1, name);
+            }
+            t->devs[t->count++] = (DevUsage){ dev, path, 0, 0, 0 };
+        }
+        t->last = i;
+    }
+    return &t->devs[i];
+}
+
+// Directories count as in the summary's total: each one entered below the starting
+// directory, and each plain one only listed (at the depth limit, or on another
+// device with -x) unless it is a repeat. A directory's files count on its device.
+static void dev_account_dir(DevTable *t, const DirFrame *frame) {
+    DevUsage *d = dev_usage(t, frame->dev, frame->path, NULL);
+    if (frame->depth > 0) d->dirs++;
+    d->files += frame->dir_file_count;
+    d->size += frame->dir_file_size;
+}
+
+static void dev_account_listed(DevTable *t, const DirFrame *parent, const WalkEntry *e) {
+    if (e->enter || e->node->is_symlink || !e->st || e->recursive) return;
+    dev_usage(t, e->st->st_dev, parent->path, e->node->name)->dirs++;
+}
 
-// ----------------- Helper function -----------------
-// Update the maximum depth reached during traversal
-static inline void track_max_depth(ActivityReport *report, int current_depth) {
-    if (report->TOTAL_depth < current_depth) {
-        report->TOTAL_depth = current_depth;
+static void dev_print(const DevTable *t) {
+    out_printf("\nDevices:\n");
+    for (size_t i = 0; i < t->count; i++) {
+        const DevUsage *d = &t->devs[i];
+        char hsize[32];
+        human_size(d->size, hsize, sizeof(hsize));
+        out_printf("  %u:%u\t%zu directories, %zu files, %s\t(first reached at %s)\n",
+                   (unsigned)major(d->dev), (unsigned)minor(d->dev), d->dirs, d->files, hsize,
+                   d->first_dir);
     }
 }
 
-// ----------------- Create a new directory frame -----------------
-// Allocates and initializes a new DirFrame, simulating a push onto an explicit stack
-DirFrame *Create_Frame(const char *dirPath, int dirDepth, const DirFrame *parent, bool is_last) {
-    DirFrame *framePtr = xmalloc(sizeof(DirFrame));
-
-    // Copy directory path into frame
-    snprintf(framePtr->path, PATH_MAX, "%s", dirPath);
-    framePtr->depth = dirDepth;
-    framePtr->is_last = is_last;
-
-    // Copy ancestor_siblings from parent for correct tree formatting
-    if (parent)
-        memcpy(framePtr->ancestor_siblings, parent->ancestor_siblings, sizeof(parent->ancestor_siblings));
-    else // Root node initialization
-        memset(framePtr->ancestor_siblings, 0, sizeof(framePtr->ancestor_siblings));
-
-    // Attempt to open the directory for reading entries
-    framePtr->dir = opendir(dirPath);
-    if (!framePtr->dir) { 
-        perror("opendir"); 
-        free(framePtr); 
-        return NULL; 
+static void dev_free(DevTable *t) {
+    for (size_t i = 0; i < t->count; i++)
+        free(t->devs[i].first_dir);
+    free(t->devs);
+}
+
+// ----------------- Print summary -----------------
+static void print_totals(const ActivityReport *report, const Options *opts, int fd_limit) {
+    char hsize[32];
+    human_size(report->TOTAL_file_size, hsize, sizeof(hsize));
+    out_printf("\nTotal Number of Directories traversed %zu (containing %zu links)\n"
+           "Maximum depth descended: %d\n", 
+           report->TOTAL_directories, report->TOTAL_linked_directories, 
+           report->TOTAL_depth);
+
+    if (opts->show_file_stats || opts->show_files || opts->du)
+        out_printf("Total Number of Files: %zu (of which %zu are linked)\n"
+               "Total File Size: %s\n",
+               report->TOTAL_file_count, report->TOTAL_linked_files, hsize);
+
+    if (opts->dedup_links && (opts->show_file_stats || opts->show_files || opts->du)) {
+        human_size(report->TOTAL_file_size - report->TOTAL_dup_size, hsize, sizeof(hsize));
+        char hdup[32];
+        human_size(report->TOTAL_dup_size, hdup, sizeof(hdup));
+        out_printf("Total File Size counting hard links once: %s (%zu extra links, %s)\n",
+                   hsize, report->TOTAL_dup_links, hdup);
     }
 
-    // Initialize Phase 1 (scanning) variables
-    framePtr->subdirs = NULL;
-    framePtr->current = NULL;
-    framePtr->subfiles = NULL;
-    framePtr->dir_file_count = 0;
-    framePtr->dir_file_size = 0;
+    if (opts->du) {
+        human_size((off_t)report->TOTAL_blocks * 512, hsize, sizeof(hsize));
+        out_printf("Total Disk Usage: %s\n", hsize);
+    }
+
+    // Diagnostics: shown with the call times, the default summary is left as it was
+    if (opts->timing && report->TOTAL_peak_fds)
+        out_printf("Peak directory fds held open: %d (budget %d)\n", report->TOTAL_peak_fds, fd_limit);
+
+    if (opts->timing && report->TOTAL_stat_avoided)
+        out_printf("Stat calls avoided using d_type: %zu\n", report->TOTAL_stat_avoided);
 
-    return framePtr;
+    if (opts->one_file_system)
+        out_printf("Directories on other devices not entered (-x): %zu\n", report->TOTAL_mounts_skipped);
+
+    if (opts->timeout_ns)
+        out_printf("Directories given up on after --timeout: %zu\n", report->TOTAL_timeouts);
+
+    if (opts->since)
+        out_printf("Directories re-read: %zu, reused from snapshot: %zu\n",
+                   report->TOTAL_dirs_reread, report->TOTAL_dirs_reused);
 }
 
-// ----------------- Add a subdirectory node -----------------
-// Appends a new SubDirNode to the linked list, updating head and tail pointers
-void add_subdir(bool is_symdir, char *sub_path, SubDirNode **head_ptr, SubDirNode **tail_ptr) {
-    // Allocate a new node and populate its path
-    SubDirNode *n = xmalloc(sizeof(SubDirNode));
-    snprintf(n->path, PATH_MAX, "%s", sub_path);
-    n->is_symlink = is_symdir;
-
-    // If it's a symlink, read its target path
-    if (is_symdir) {
-        ssize_t len = readlink(sub_path, n->sym_path, PATH_MAX - 1);
-        if (len != -1) n->sym_path[len] = '\0'; // readlink does not null-terminate
-        else n->sym_path[0] = '\0'; // readlink failed
-    } else {
-        n->sym_path[0] = '\0';
+// Machine readable formats keep stdout for records only, and --stats-json - for the
+// JSON document
+static bool summary_on_stderr(const Options *opts) {
+    return (opts->output_format != OUTPUT_TREE && opts->output_format != OUTPUT_NONE)
+           || (opts->stats_json && !strcmp(opts->stats_json, "-"));
+}
+
+static void end_records(const Options *opts) {
+    print_end(opts);
+    if (summary_on_stderr(opts)) out_set_fd(STDERR_FILENO);
+}
+
+static void print_summary(const ActivityReport *report, const Options *opts, int fd_limit) {
+    end_records(opts);
+    print_totals(report, opts, fd_limit);
+}
+
+// Totals of several walks: the counts add up, depth and fd peak are the largest one's
+static void report_add(ActivityReport *sum, const ActivityReport *r) {
+    sum->TOTAL_file_count += r->TOTAL_file_count;
+    sum->TOTAL_linked_files += r->TOTAL_linked_files;
+    sum->TOTAL_file_size += r->TOTAL_file_size;
+    sum->TOTAL_directories += r->TOTAL_directories;
+    sum->TOTAL_linked_directories += r->TOTAL_linked_directories;
+    track_max_depth(sum, r->TOTAL_depth);
+    sum->TOTAL_stat_avoided += r->TOTAL_stat_avoided;
+    if (sum->TOTAL_peak_fds < r->TOTAL_peak_fds) sum->TOTAL_peak_fds = r->TOTAL_peak_fds;
+    sum->TOTAL_dirs_reread += r->TOTAL_dirs_reread;
+    sum->TOTAL_dirs_reused += r->TOTAL_dirs_reused;
+    sum->TOTAL_blocks += r->TOTAL_blocks;
+    sum->TOTAL_dup_links += r->TOTAL_dup_links;
+    sum->TOTAL_dup_size += r->TOTAL_dup_size;
+    sum->TOTAL_mounts_skipped += r->TOTAL_mounts_skipped;
+    sum->TOTAL_timeouts += r->TOTAL_timeouts;
+}
+
+// ----------------- Machine readable summary (--stats-json) -----------------
+// The summary's totals (all of them, whichever options are on, but --since's), how
+// long the walk took and the file system call times. Returns false if path can't be written.
+static bool write_stats_json(const char *path, const ActivityReport *r, const Options *opts,
+                             uint64_t elapsed_ns) {
+    bool to_stdout = !strcmp(path, "-");
+    if (to_stdout) out_flush();
+    FILE *f = to_stdout ? stdout : fopen(path, "w");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    fprintf(f, "{\n  \"directories\": %zu,\n  \"linked_directories\": %zu,\n  \"files\": %zu,\n"
+               "  \"linked_files\": %zu,\n  \"file_size\": %jd,\n  \"blocks\": %jd,\n  \"max_depth\": %d,\n"
+               "  \"stat_avoided\": %zu,\n  \"peak_fds\": %d,\n  \"fd_budget\": %d,\n"
+               "  \"dup_links\": %zu,\n  \"dup_size\": %jd,\n  \"mounts_skipped\": %zu,\n"
+               "  \"timeouts\": %zu,\n",
+            r->TOTAL_directories, r->TOTAL_linked_directories, r->TOTAL_file_count,
+            r->TOTAL_linked_files, (intmax_t)r->TOTAL_file_size, (intmax_t)r->TOTAL_blocks, r->TOTAL_depth,
+            r->TOTAL_stat_avoided, r->TOTAL_peak_fds, opts->fd_budget, r->TOTAL_dup_links,
+            (intmax_t)r->TOTAL_dup_size, r->TOTAL_mounts_skipped, r->TOTAL_timeouts);
+    if (opts->since)
+        fprintf(f, "  \"dirs_reread\": %zu,\n  \"dirs_reused\": %zu,\n",
+                r->TOTAL_dirs_reread, r->TOTAL_dirs_reused);
+    fprintf(f, "  \"elapsed_ns\": %ju,\n  \"calls\": ", (uintmax_t)elapsed_ns);
+    timing_write_json(f);
+    fputs("\n}\n", f);
+    bool ok = !ferror(f);
+    if (to_stdout ? fflush(f) != 0 : fclose(f) != 0) ok = false;
+    if (!ok) perror(path);
+    return ok;
+}
+
+// ----------------- The tree printer -----------------
+// The walk's visitor: prints each entry as it is reached and collects what the
+// summary shows
+typedef struct Printer {
+    Options *opts;
+    TopList top_files, top_dirs, top_trees;     // Largest files, and directories by their own files and by subtree (--top N)
+    DevTable devices;                           // Directories, files and sizes by device (--devices)
+    TopList slowest;                            // Directories that took longest to open and read (--timing)
+    Progress progress;                          // --progress
+    const ActivityReport *report;               // The walk's running totals
+} Printer;
+
+static void printer_enter_dir(void *ctx, const DirFrame *frame) {
+    Printer *p = ctx;
+    Options *opts = p->opts;
+    if (opts->show_devices) dev_account_dir(&p->devices, frame);
+    if (opts->timing && frame->scan_ns) top_add(&p->slowest, frame->path, NULL, (off_t)frame->scan_ns);
+    if (opts->progress_ms) progress_check(&p->progress, p->report, frame, timing_now());
+
+    // Print current directory line (--du prints it after the subtree)
+    if (!opts->du)
+        print_entry_line(frame, frame->is_last,
+                         false, NULL, false, NULL, true, opts);
+
+    // Print files if requested (last collected first)
+    if (opts->show_files)
+        for (size_t i = frame->subfile_count; i-- > 0;)
+            print_file_line(frame, &frame->subfiles[i], opts);
+
+    if (opts->top) {
+        for (size_t i = 0; i < frame->subfile_count; i++)
+            if (!frame->subfiles[i].is_symlink)
+                top_add(&p->top_files, frame->path, frame->subfiles[i].name, frame->subfiles[i].size);
+        top_add(&p->top_dirs, frame->path, NULL, frame->dir_file_size);
+    }
+    out_dir_done();
+}
+
+static void printer_subdir(void *ctx, const DirFrame *parent, const WalkEntry *e) {
+    Printer *p = ctx;
+    Options *opts = p->opts;
+    if (opts->show_devices) dev_account_listed(&p->devices, parent, e);
+    if (opts->summary_only) return;
+
+    // Update ancestor_siblings array for next depth
+    if (parent->depth + 1 < opts->max_depth)
+        set_ancestor_sibling(parent, parent->depth + 1, !e->is_last);
+
+    // --du prints a followed link after its subtree, with the totals
+    if (e->node->is_symlink) {
+        if (!opts->du || !e->enter)
+            print_entry_line(e->dir, e->is_last, true, e->node->sym_path,
+                             e->recursive, NULL, true, opts);
+    } else if (!e->enter) {
+        print_entry_line(e->dir, e->is_last, false, NULL,
+                         e->recursive, NULL, true, opts);
     }
+}
+
+static void printer_enter_failed(void *ctx, const DirFrame *parent, const WalkEntry *e, int err) {
+    Printer *p = ctx;
+    (void)parent;
+    errno = err;
+    out_perror("opendir");
+    if (p->opts->du && e->node->is_symlink)
+        print_entry_line(e->dir, e->is_last, true, e->node->sym_path,
+                         false, NULL, true, p->opts);
+}
 
-    n->next = NULL;
+// The subtree is complete: print (--du) or rank (--top) it
+static void printer_leave_dir(void *ctx, const DirFrame *frame, const DirFrame *parent) {
+    Printer *p = ctx;
+    (void)parent;
+    if (p->opts->du) print_du_line(frame, p->opts);
+    if (p->opts->top) top_add(&p->top_trees, frame->path, NULL, frame->tree_file_size);
+}
 
-    // Append node to linked list
-    if (!*head_ptr) {
-        *head_ptr = n;
-        *tail_ptr = n; // first node: tail points here too
+static void printer_error(void *ctx, const char *path, int err) {
+    (void)ctx;
+    errno = err;
+    out_perror(path);
+}
+
+// --checkpoint: everything printed so far goes out, and the checkpoint notes where
+// stdout stands (if it is a file) and how many records it holds
+static void printer_checkpoint(void *ctx, uint64_t data[WALK_CHECKPOINT_DATA]) {
+    (void)ctx;
+    out_flush();
+    struct stat st;
+    off_t pos;
+    if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode) && (pos = lseek(STDOUT_FILENO, 0, SEEK_CUR)) != -1) {
+        data[0] = (uint64_t)pos;
+        data[2] = (uint64_t)st.st_dev;
+        data[3] = (uint64_t)st.st_ino;
+    }
+    data[1] = print_records();
+}
+
+static void printer_init(Printer *p, Options *opts) {
+    *p = (Printer){ .opts = opts };
+    top_init(&p->top_files, opts->top);
+    top_init(&p->top_dirs, opts->top);
+    top_init(&p->top_trees, opts->top);
+    top_init(&p->slowest, opts->timing);
+}
+
+static WalkVisitor printer_visitor(Printer *p) {
+    return (WalkVisitor){
+        .ctx = p,
+        .enter_dir = printer_enter_dir,
+        .subdir = p->opts->summary_only && !p->opts->show_devices ? NULL : printer_subdir,  // -q: they would only be printed
+        .enter_failed = printer_enter_failed,
+        .leave_dir = printer_leave_dir,
+        .error = printer_error,
+        .checkpoint = printer_checkpoint,
+    };
+}
+
+// What follows the totals: --devices, --timing (slowest: NULL to leave it out) and --top
+static void printer_print(Printer *p, TopList *slowest) {
+    if (p->opts->show_devices) dev_print(&p->devices);
+    if (slowest) timing_print(slowest);
+    if (p->opts->top) {
+        top_print(&p->top_files, "Largest files");
+        top_print(&p->top_dirs, "Largest directories (own files)");
+        top_print(&p->top_trees, "Largest directories (whole subtree)");
+    }
+}
+
+static void printer_free(Printer *p) {
+    dev_free(&p->devices);
+    top_free(&p->slowest);
+    top_free(&p->top_files);
+    top_free(&p->top_dirs);
+    top_free(&p->top_trees);
+}
+
+// ----------------- Live tree (--watch) -----------------
+// Every update is printed from the tree kept in memory, like --load-snapshot; on a
+// terminal it replaces the previous one
+static void watch_render(void *ctx, const Snapshot *tree, const ActivityReport *walked, uint64_t walk_ns) {
+    Options *opts = ctx;
+    uint64_t start = timing_now();
+    if (opts->output_format == OUTPUT_TREE && isatty(STDOUT_FILENO))
+        out_puts("\033[H\033[2J");
+    print_begin(opts);
+    ActivityReport report = {0};
+    snapshot_print(tree, opts, &report);
+    print_summary(&report, opts, opts->fd_budget);
+    out_printf("Walked in %.1f ms (directories re-read: %zu, unchanged: %zu), shown in %.1f ms. "
+               "Watching for changes\n", walk_ns / 1e6, walked->TOTAL_dirs_reread,
+               walked->TOTAL_dirs_reused, (timing_now() - start) / 1e6);
+    out_flush();
+    out_set_fd(STDOUT_FILENO);
+}
+
+// ----------------- Several roots -----------------
+// Every root gets a Walk and Printer of its own, printing into a temporary file. One
+// thread per device walks that device's roots in turn, so the disks are read in
+// parallel but none by two walks at once, while the main thread copies each tree to
+// stdout once it and those before it are complete. The walks share a visited set
+// holding every root from the start: a root inside another is shown as a root of
+// its own (and [recursive] where the other walk reaches it).
+typedef struct RootWalk {
+    const char *path;
+    dev_t dev;
+    size_t worker;              // Index of the device's thread
+    int err;                    // errno if the root couldn't be walked
+    FILE *out;                  // What it printed, until copied to stdout
+    size_t records;             // Records in out (-o json joins them into one array)
+    Printer printer;
+    ActivityReport report;
+    bool done;                  // Guarded by RootSet.lock
+} RootWalk;
+
+typedef struct RootSet {
+    RootWalk *roots;
+    size_t count;
+    Options *opts;
+    VisitedSet *visited;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;    // A root is done
+} RootSet;
+
+typedef struct DeviceWorker {
+    RootSet *set;
+    size_t index;
+    dev_t dev;
+    pthread_t thread;
+    bool started;
+} DeviceWorker;
+
+static void walk_root(RootSet *set, RootWalk *r) {
+    if (!(r->out = tmpfile())) {
+        r->err = errno;
+        return;
+    }
+    out_begin_thread(fileno(r->out));
+    print_set_records(0);
+    WalkVisitor visitor = printer_visitor(&r->printer);
+    Walk *w = walk_create_shared(r->path, set->opts, &visitor, set->visited);
+    if (w) {
+        r->printer.report = walk_report(w);
+        walk_run(w);
+        r->report = *walk_report(w);
+        walk_free(w);
     } else {
-        (*tail_ptr)->next = n;
-        *tail_ptr = n;
+        r->err = errno;
+    }
+    r->records = print_records();
+    out_end_thread();
+}
+
+static void *device_worker(void *arg) {
+    DeviceWorker *dw = arg;
+    RootSet *set = dw->set;
+    for (size_t i = 0; i < set->count; i++) {
+        RootWalk *r = &set->roots[i];
+        if (r->worker != dw->index || r->done) continue;
+        walk_root(set, r);
+        pthread_mutex_lock(&set->lock);
+        r->done = true;
+        pthread_cond_broadcast(&set->finished);
+        pthread_mutex_unlock(&set->lock);
+    }
+    return NULL;
+}
+
+static void copy_output(FILE *f) {
+    char buf[OUT_BUFFER_SIZE];
+    rewind(f);
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        out_write(buf, n);
+}
+
+// After each tree its totals (with -o FORMAT they all follow the records), then the
+// totals of all the roots
+static int walk_roots(char **paths, size_t count, Options *opts, uint64_t start) {
+    RootSet set = { .roots = xcalloc(count, sizeof(RootWalk)), .count = count, .opts = opts,
+                    .visited = create_shared_visited(opts->expect_dirs) };
+    pthread_mutex_init(&set.lock, NULL);
+    pthread_cond_init(&set.finished, NULL);
+    DeviceWorker *workers = xcalloc(count, sizeof(DeviceWorker));
+    size_t worker_count = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        RootWalk *r = &set.roots[i];
+        r->path = paths[i];
+        printer_init(&r->printer, opts);
+        struct stat st;
+        if (stat(r->path, &st) == -1) {
+            r->err = errno;
+            r->done = true;
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) add_visited(set.visited, st.st_dev, st.st_ino);
+        r->dev = st.st_dev;
+        for (r->worker = 0; r->worker < worker_count && workers[r->worker].dev != st.st_dev; r->worker++)
+            ;
+        if (r->worker == worker_count)
+            workers[worker_count++] = (DeviceWorker){ .set = &set, .index = r->worker, .dev = st.st_dev };
+    }
+    for (size_t i = 0; i < worker_count; i++)
+        workers[i].started = pthread_create(&workers[i].thread, NULL, device_worker, &workers[i]) == 0;
+    for (size_t i = 0; i < worker_count; i++)
+        if (!workers[i].started) device_worker(&workers[i]);   // No thread: walk its roots here
+
+    bool tree = opts->output_format == OUTPUT_TREE;
+    bool ok = true;
+    ActivityReport all = {0};
+    TopList slowest;
+    top_init(&slowest, opts->timing);
+    for (size_t i = 0; i < count; i++) {
+        RootWalk *r = &set.roots[i];
+        pthread_mutex_lock(&set.lock);
+        while (!r->done)
+            pthread_cond_wait(&set.finished, &set.lock);
+        pthread_mutex_unlock(&set.lock);
+        if (r->out) {
+            if (tree && i > 0) out_puts("\n");
+            if (opts->output_format == OUTPUT_JSON && r->records && print_records()) out_puts(",\n");
+            copy_output(r->out);
+            fclose(r->out);
+            print_set_records(print_records() + r->records);
+        }
+        if (r->err) {
+            errno = r->err;
+            out_perror(r->path);
+            ok = false;
+            continue;
+        }
+        report_add(&all, &r->report);
+        for (size_t k = 0; k < r->printer.slowest.count; k++)
+            top_add(&slowest, r->printer.slowest.heap[k].path, NULL, r->printer.slowest.heap[k].size);
+        if (tree) {
+            if (summary_on_stderr(opts)) out_set_fd(STDERR_FILENO);
+            print_totals(&r->report, opts, opts->fd_budget);
+            printer_print(&r->printer, NULL);
+            out_set_fd(STDOUT_FILENO);
+        }
+        out_dir_done();
+    }
+    uint64_t elapsed = timing_now() - start;
+
+    end_records(opts);
+    for (size_t i = 0; i < count && !tree; i++) {
+        RootWalk *r = &set.roots[i];
+        if (r->err) continue;
+        out_printf("\n%s:", r->path);
+        print_totals(&r->report, opts, opts->fd_budget);
+        printer_print(&r->printer, NULL);
     }
+    out_printf("\nAll %zu starting directories:", count);
+    print_totals(&all, opts, opts->fd_budget);
+    if (opts->timing) timing_print(&slowest);
+    out_flush();
+    if (opts->stats_json && !write_stats_json(opts->stats_json, &all, opts, elapsed)) ok = false;
+
+    for (size_t i = 0; i < worker_count; i++)
+        if (workers[i].started) pthread_join(workers[i].thread, NULL);
+    for (size_t i = 0; i < count; i++)
+        printer_free(&set.roots[i].printer);
+    top_free(&slowest);
+    free(workers);
+    free(set.roots);
+    free_visited_node_hash(set.visited);
+    pthread_mutex_destroy(&set.lock);
+    pthread_cond_destroy(&set.finished);
+    filter_free(opts->exclude);
+    filter_free(opts->include);
+    timing_free();
+    out_flush();
+    return ok ? 0 : EXIT_FAILURE;
 }
 
-// ----------------- Free linked list of subdirectories -----------------
-void free_subdirs(SubDirNode *head) {
-    SubDirNode *cur = head, *next;
-    while (cur) { 
-        next = cur->next;
-        free(cur);
-        cur = next;
+// ----------------- Resuming (--resume) -----------------
+// The output carries on from the checkpoint too. If stdout is the file the interrupted
+// run printed to, whatever that printed after the checkpoint is cut off first, so the
+// file ends up as one uninterrupted run would have left it.
+static void resume_output(const uint64_t data[WALK_CHECKPOINT_DATA]) {
+    print_set_records(data[1]);
+    struct stat st;
+    if (data[3] && fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode) &&
+        (uint64_t)st.st_dev == data[2] && (uint64_t)st.st_ino == data[3] &&
+        (uint64_t)st.st_size >= data[0] && ftruncate(STDOUT_FILENO, (off_t)data[0]) == 0) {
+        lseek(STDOUT_FILENO, 0, SEEK_END);
+        return;
     }
+    if (data[3])
+        fprintf(stderr, "Resuming: this output follows byte %ju of the interrupted run's\n",
+                (uintmax_t)data[0]);
 }
 
 // ------------------------- Main function -------------------------
@@ -104,201 +574,97 @@ int main(int argc, char *argv[]) {
 	// Handle -v & -h options 
 	if (opts.show_version){show_version(); return EXIT_SUCCESS;}
 	if (opts.show_help){show_help(); return EXIT_SUCCESS;}
+	if (opts.timing || opts.timeout_ns || opts.stats_json) timing_enable();
+    uint64_t start = timing_now();
+
+    // A snapshot is a full walk: everything is collected, nothing is printed
+    if (opts.save_snapshot) {
+        opts.show_hidden = true;
+        opts.show_files = true;
+        opts.max_depth = MAX_DEPTH;
+        opts.output_format = OUTPUT_NONE;
+        filter_free(opts.exclude);      // --since may later reuse any listing unfiltered
+        filter_free(opts.include);
+        opts.exclude = opts.include = NULL;
+    }
 
-    // Initialize all counters to 0
-    ActivityReport final_report = {0};
-
-    // Explicit stack for DirFrame pointers (simulate recursion)
-    DirFrame *stack[MAX_DEPTH + 2];
-    int sp = 0; // stack pointer: next free slot
-
-    // Create root frame & push onto stack. default to . if no directory specified
-    DirFrame *root = Create_Frame(first_file_index == - 1 ? "." : argv[first_file_index], 0, NULL, false);
-	if(!root){
- 		fprintf(stderr, "Invalid starting directory specified\n"); 
- 		return EXIT_FAILURE;
-	}
-
-    stack[sp++] = root;
-
-    // Hash table to track visited directories to prevent infinite recursion via symlinks
-    create_visited_node_hash();
-
-    // Record root directory's unique device/inode ID in case symlinks loop back to it
-    struct stat st_root;	
-	if (stat(root->path, &st_root) == 0) {
-		add_visited(st_root.st_dev, st_root.st_ino);
-	}
+    // All stdout output is batched through output.c
+    out_init(STDOUT_FILENO, opts.flush_on_dir);
 
-    // ------------------ Main traversal loop ------------------
-    // Loop continues while there are frames (directories) on the stack
-    while (sp > 0) {
-        DirFrame *frame = stack[sp - 1]; // peek at top of stack
-
-        // ------------------ Phase 1: Scan current directory ------------------
-        if (!frame->subdirs) {
-            struct dirent *entry;
-            struct stat st, lst;
-            char buf[PATH_MAX];
-            SubDirNode *head = NULL, *tail = NULL;
-
-            frame->dir_file_count = 0;
-            frame->dir_file_size = 0;
-
-            // Read each entry in the directory
-            while ((entry = readdir(frame->dir)) != NULL) {
-                // skip any directory starting with a . unless we're showing hidden directores
-                if(!opts.show_hidden && entry->d_name[0] == '.')
-                	continue;
-
-            	// always skip . and .. directories 
-                if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
-                    continue;
-                
-                // Build full path
-                if (snprintf(buf, PATH_MAX, "%s/%s", frame->path, entry->d_name) >= PATH_MAX)
-                    continue;
-
-                if (lstat(buf, &lst) == -1) continue;
-                if (stat(buf, &st) == -1) st.st_mode = 0;
-
-                // Handle files (update stats, print if needed)
-                HandleFiles(buf, frame, &st, &lst, &final_report, opts.show_files);
-
-                bool is_symdir = S_ISLNK(lst.st_mode) && S_ISDIR(st.st_mode);
-
-                // Add subdirectory to list (regardless of if visited - this is checked in phase 2)
-                if (S_ISDIR(st.st_mode) || is_symdir)
-                    add_subdir(is_symdir, buf, &head, &tail);
-            }
+    // Default to . if no directory specified
+    const char *root_path = first_file_index == - 1 ? "." : argv[first_file_index];
 
-            // Save list to frame
-            frame->subdirs = head;
-            frame->current = head;
-
-            // Print current directory line
-            print_entry_line(frame, frame->is_last,
-                            	false, NULL, false, NULL, true, &opts);
-			
-            // Print files if requested
-            if (opts.show_files) {
-                SubDirFile *cur = frame->subfiles, *prev;
-                while (cur != NULL) {
-                    prev = cur->prev;
-                    print_entry_line(frame, frame->is_last,
-                            	cur->is_symlink, NULL, false, cur->name, false, &opts);
-                    cur = prev;
-                }
-                free_subfiles(frame->subfiles);
-            }
+    // Stay resident and print the tree again whenever it changes
+    if (opts.watch_ms) {
+        watch_run(root_path, &opts, watch_render, &opts);
+        if (errno) {
+            out_perror("opendir");
+            fprintf(stderr, "Invalid starting directory specified\n");
         }
-
-        // ----------------- Phase 2: Process the next subdirectory -----------------
-        if (frame->current) {
-            SubDirNode *cur = frame->current;
-            frame->current = cur->next;        // advance iterator
-            bool is_last_child = (frame->current == NULL);
-
-            // Update ancestor_siblings array for next depth
-            if (frame->depth + 1 < opts.max_depth)
-                frame->ancestor_siblings[frame->depth + 1] = !is_last_child;
-
-            struct stat st_target;
-            bool stat_ok = (stat(cur->path, &st_target) == 0); // follow symlink
-
-			// ---------------- Symlinked directories ----------------
-			if (cur->is_symlink) {
-				bool already_visited = stat_ok && visited_before(st_target.st_dev, st_target.st_ino);
-			
-				// Prepare temporary frame for printing
-				DirFrame temp = {0};
-				snprintf(temp.path, PATH_MAX, "%s", cur->path);
-				temp.depth = frame->depth + 1;
-				memcpy(temp.ancestor_siblings, frame->ancestor_siblings, sizeof(temp.ancestor_siblings));
-			
-				print_entry_line(&temp, is_last_child, true, cur->sym_path,
-								 already_visited, NULL, true, &opts);
-			
-				// increment total linked directories even if not traversed
-				if (stat_ok) final_report.TOTAL_linked_directories++;
-			
-				// Only traverse symlink if not visited, option allows, stat ok, AND depth limit not hit
-				bool depth_limit_hit = (frame->depth + 1 >= opts.max_depth);
-				if (!already_visited && opts.follow_links && stat_ok && !depth_limit_hit) {
-					DirFrame *child = Create_Frame(cur->path, frame->depth + 1, frame, is_last_child);
-					if (child) {
-						if (add_visited(st_target.st_dev, st_target.st_ino)) {
-							final_report.TOTAL_directories++;
-						}
-						stack[sp++] = child;
-						track_max_depth(&final_report, child->depth);
-					}
-				} else {
-					// If we couldn't traverse because of depth limit but it's not a visit loop,
-					// still update the reported max depth if you want consistent "max reached" accounting:
-					if (!already_visited && depth_limit_hit) {
-						track_max_depth(&final_report, frame->depth + 1);
-					}
-				}
-			
-				continue; // move to next subdirectory
-			}
-
-            // ---------------- Normal directories ----------------
-			if (stat_ok && S_ISDIR(st_target.st_mode)) {
-				bool already_visited = visited_before(st_target.st_dev, st_target.st_ino);
-				bool depth_limit_hit = (frame->depth + 1 >= opts.max_depth);
-			
-				if (!already_visited && !depth_limit_hit) {
-					// normal traversal
-					DirFrame *child = Create_Frame(cur->path, frame->depth + 1, frame, is_last_child);
-					if (child) {
-						if (add_visited(st_target.st_dev, st_target.st_ino)) {
-							final_report.TOTAL_directories++;
-						}
-						stack[sp++] = child;
-						track_max_depth(&final_report, child->depth);
-					}
-				} else {
-					// only mark recursive if actually already visited
-					DirFrame temp = {0};
-					snprintf(temp.path, PATH_MAX, "%s", cur->path);
-					temp.depth = frame->depth + 1;
-					memcpy(temp.ancestor_siblings, frame->ancestor_siblings, sizeof(temp.ancestor_siblings));
-			
-					print_entry_line(&temp, is_last_child, false, cur->path,
-									 already_visited, NULL, true, &opts);
-					if (add_visited(st_target.st_dev, st_target.st_ino)) {
-						final_report.TOTAL_directories++;
-					}
-					track_max_depth(&final_report, frame->depth + 1);
-				}
-			}
-
-        } else {
-            // Directory fully processed: pop and clean up
-            closedir(frame->dir);
-            free_subdirs(frame->subdirs);
-            free(frame);
-            sp--;
+        out_flush();
+        return EXIT_FAILURE;
+    }
+    if (!opts.resume) print_begin(&opts);     // A resumed walk's output has begun already
+
+    // Print a saved walk instead of walking
+    if (opts.load_snapshot) {
+        ActivityReport final_report = {0};
+        if (!snapshot_render(opts.load_snapshot, &opts, &final_report)) {
+            out_flush();
+            return EXIT_FAILURE;
         }
+        print_summary(&final_report, &opts, opts.fd_budget);
+        out_flush();
+        if (opts.stats_json && !write_stats_json(opts.stats_json, &final_report, &opts,
+                                                 timing_now() - start))
+            return EXIT_FAILURE;
+        return 0;
     }
 
-    // ----------------- Clean up -----------------
-    free_visited_node_hash(); // free memory for loop-detection hash
+    // Several starting directories: walked at once, shown one after the other
+    if (first_file_index != -1 && argc - first_file_index > 1)
+        return walk_roots(argv + first_file_index, (size_t)(argc - first_file_index), &opts, start);
+
+    Printer printer;
+    printer_init(&printer, &opts);
+    WalkVisitor visitor = printer_visitor(&printer);
+
+    // Walk the tree
+    Walk *walk = opts.resume ? walk_resume(opts.resume, &opts, &visitor)
+                             : walk_create(root_path, &opts, &visitor);
+	if (!walk) {
+		if (errno) {
+			out_perror("opendir");
+			fprintf(stderr, "Invalid starting directory specified\n");
+		}
+		return EXIT_FAILURE;
+	}
+    if (opts.resume) resume_output(walk_resumed(walk));
+    printer.report = walk_report(walk);
+    if (opts.progress_ms)
+        progress_init(&printer.progress, opts.progress_ms,
+                      opts.show_file_stats || opts.show_files || opts.du);
+    bool snap_ok = walk_run(walk);
+    uint64_t elapsed = timing_now() - start;
+    progress_done(&printer.progress);
 
     // ----------------- Print summary -----------------
-    char hsize[32];
-    human_size(final_report.TOTAL_file_size, hsize, sizeof(hsize));
-    printf("\nTotal Number of Directories traversed %zu (containing %zu links)\n"
-           "Maximum depth descended: %d\n", 
-           final_report.TOTAL_directories, final_report.TOTAL_linked_directories, 
-           final_report.TOTAL_depth);
+    end_records(&opts);
+    if (opts.save_snapshot && snap_ok)
+        out_printf("Snapshot of %ld entries saved to %s\n", walk_snapshot_entries(walk), opts.save_snapshot);
+    print_totals(walk_report(walk), &opts, opts.fd_budget);
+    printer_print(&printer, opts.timing ? &printer.slowest : NULL);
+    out_flush();
+    bool stats_ok = !opts.stats_json
+                    || write_stats_json(opts.stats_json, walk_report(walk), &opts, elapsed);
 
-    if (opts.show_file_stats || opts.show_files)
-        printf("Total Number of Files: %zu (of which %zu are linked)\n"
-               "Total File Size: %s\n",
-               final_report.TOTAL_file_count, final_report.TOTAL_linked_files, hsize);
-
-    return 0;
+    // ----------------- Clean up -----------------
+    walk_free(walk);
+    filter_free(opts.exclude);
+    filter_free(opts.include);
+    printer_free(&printer);
+    timing_free();
+    out_flush();
+
+    return snap_ok && stats_ok ? 0 : EXIT_FAILURE;
 }
@@ -2,7 +2,12 @@
 #define GTREE_H  
 
 #include <stdbool.h>
+#include <stdint.h>     // For uint64_t
 #include <dirent.h>     // For DIR, struct dirent, opendir, readdir, closedir (POSIX)
+#include <sys/types.h>  // For dev_t, ino_t, mode_t
+#include <sys/stat.h>   // For struct stat
+#include <time.h>       // For struct timespec
+#include "arena.h"
 
 
 // Fallback maximum path length if PATH_MAX is not defined by the system
@@ -18,38 +23,120 @@
 // Defines the maximum depth and also the size of the explicit stack array
 #define MAX_DEPTH 1024   
 
-// Node structure to hold subdirectory info in a linked list.
+// Default number of directory fds frames on the stack may hold open at once (-F N)
+#define DEFAULT_FD_BUDGET 64
+
+// Upper limit for the number of scan worker threads (-P N)
+#define MAX_SCAN_THREADS 256
+
+// Slowest directories listed by --timing without a count
+#define DEFAULT_SLOWEST_DIRS 10
+
+// Time --watch collects changes for before each update, in ms
+#define DEFAULT_WATCH_MS 500
+
+// Interval between --progress lines, in ms
+#define DEFAULT_PROGRESS_MS 1000
+
+// Interval between --checkpoint saves, in ms
+#define DEFAULT_CHECKPOINT_MS 60000
+
+// st_mtime / st_ctime including nanoseconds
+#ifdef __APPLE__
+#define ST_MTIM(st) ((st)->st_mtimespec)
+#define ST_CTIM(st) ((st)->st_ctimespec)
+#else
+#define ST_MTIM(st) ((st)->st_mtim)
+#define ST_CTIM(st) ((st)->st_ctim)
+#endif
+
+// SubDirNode, SubDirFile and DirFrame records (and the strings they point to) are
+// allocated from arenas rather than individually, see arena.h.
+
+// Subdirectory info, stored in a contiguous per-frame array.
 // Used to store subdirectories discovered in a directory *before* traversing them.
 // This decouples the scanning phase from the descending phase.
 typedef struct SubDirNode {
-    char path[PATH_MAX];       // Full path of the subdirectory (e.g., "/home/user/dir/subdir")
+    char *name;                // Entry name of the subdirectory within its parent (e.g., "subdir")
     bool is_symlink;           // True if this directory entry itself is a symbolic link
-    char sym_path[PATH_MAX];   // Target path if symlink (e.g., "../../otherdir")
-    struct SubDirNode *next;   // Pointer to next subdirectory (linked list for children)
+    char *sym_path;            // Target path if symlink (e.g., "../../otherdir"), else "". NULL
+                               // until Phase 2 reads it, and with --no-link-targets
+    ino_t link_ino;            // Inode of the symlink itself (link target cache), 0 if unknown
+    bool has_stat;             // True if dev/ino/mode/times below were filled in by the Phase 1 stat()
+    dev_t dev;                 // Device ID of the (followed) directory
+    ino_t ino;                 // Inode number of the (followed) directory
+    mode_t mode;               // File mode of the (followed) directory
+    struct timespec mtime;     // Modification / change times of the (followed) directory
+    struct timespec ctime;
+    blkcnt_t blocks;           // 512-byte blocks allocated to the (followed) directory (--du)
+    long since;                // --since snapshot entry of this subdirectory if the listing came
+                               // from the snapshot, else -1
+    struct ScanJob *job;       // Pending parallel scan of this subdirectory (-P), else NULL
 } SubDirNode;
 
 typedef struct SubDirFile {
-    char name[PATH_MAX];       // File Name 
+    char *name;                // File name within its directory
+    char *target;              // Link target if symlink (NULL if not shown), else NULL
+    off_t size;                // Size of the file (or of the link's target)
+    blkcnt_t blocks;           // 512-byte blocks allocated to it (as size)
+    dev_t dev;                 // Device/inode of the file (of the link itself if dangling)
+    ino_t ino;
+    struct timespec mtime;     // Modification time (of the link itself if dangling)
     bool is_symlink;           // True if this file is a symbolic link
-    struct SubDirFile *prev;  // Pointer to previous file (linked list for children)
+    bool dangling;             // True if it is a symlink whose target doesn't exist
+    bool multi_link;           // True if the file has more than one hard link
 } SubDirFile;
 
+// A counted file with more than one hard link (-H), queued so the main loop can
+// count each dev/ino once, in walk order, whichever thread scanned the directory
+typedef struct LinkedFile {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    blkcnt_t blocks;
+} LinkedFile;
+
 // Frame structure representing one directory level in the explicit stack.
 // This structure replaces the 'stack frame' of a recursive function call.
 typedef struct DirFrame {
 	// these are the basic frame components to manage the traversal
-    char path[PATH_MAX];         // Path of this directory
-    DIR *dir;                    // DIR* stream for reading entries with readdir
-    SubDirNode *subdirs;         // Head of the linked list of subdirectories found (Phase 1 result)
-    SubDirNode *current;         // Pointer to the current subdir being processed (iterator for Phase 2)
+    char *path;                  // Path of this directory (built once, used for printing)
+    Arena *arena;                // Per-frame arena: frame, path and subdirs; reset on pop
+    int fd;                      // Directory fd; entries are opened/stat()ed relative to it (-1 if evicted)
+    SubDirNode *subdirs;         // Array of subdirectories found (Phase 1 result), NULL if none
+    size_t subdir_count;         // Entries in subdirs
+    size_t subdir_cap;           // Entries allocated for subdirs (while scanning)
+    size_t current;              // Index of the next subdir to process (iterator for Phase 2)
     int depth;                   // Depth in the directory tree (0 = starting directory)
 	// additional file stats for this directory only 
     size_t dir_file_count;       // Number of non-directory files in this specific directory
     off_t dir_file_size;         // Cumulative size of regular files in this specific directory
-    SubDirFile *subfiles;		 // Tail of linked list for files 
+    blkcnt_t dir_file_blocks;    // 512-byte blocks allocated to those files
+	// recursive totals for --du, complete when the frame is popped
+    size_t tree_file_count;      // Files in this subtree
+    off_t tree_file_size;        // Size of the files in this subtree
+    blkcnt_t tree_blocks;        // Blocks of the files and directories (this one included) in this subtree
+    SubDirFile *subfiles;		 // Array of files for -f, printed last to first
+    size_t subfile_count;        // Entries in subfiles
+    size_t subfile_cap;          // Entries allocated for subfiles (while scanning)
+    LinkedFile *linked;          // -H: files with several hard links, deduplicated before printing
+    size_t linked_count;         // Entries in linked
+    size_t linked_cap;           // Entries allocated for linked (while scanning)
 	// these are purely for print formatting
-    bool ancestor_siblings[MAX_DEPTH+2]; // Used to track tree branches for formatted output (│/└/├)
+    bool *ancestor_siblings;     // Shared depth-indexed array tracking tree branches for output (│/└/├)
     bool is_last;                // True if this directory is the last among its siblings (for print formatting)
+    bool printed;                // True once the directory line (and files) have been printed
+    bool is_symlink;             // Reached through a followed symlink
+    const char *sym_path;        // Its target (NULL if not shown), else NULL
+	// parallel scanning (-P)
+    struct ScanJob *job;         // Scan result produced by a worker thread, else NULL
+    long since;                  // --since snapshot entry with this directory's listing, or -1
+    dev_t dev;                   // Device the directory is on (--devices, loop detection)
+    ino_t ino;                   // Its inode (loop detection without a visited set)
+	// --timing / --timeout
+    uint64_t scan_ns;            // Wall time spent opening and reading the directory
+    bool timed_out;              // Reading took longer than --timeout: listed empty, as [timeout]
+    int read_err;                // errno if reading stopped part way (the listing is what was read), else 0
 } DirFrame;
 
 // -------------------------------- Final Report -------------------------------
@@ -61,8 +148,32 @@ typedef struct ActivityReport {
 	size_t TOTAL_directories;          // Total directories successfully traversed
 	size_t TOTAL_linked_directories;   // Symlinked directories encountered
 	int TOTAL_depth;				   // max number of levels we descended
+	size_t TOTAL_stat_avoided;         // lstat()/stat() calls skipped thanks to dirent d_type
+	int TOTAL_peak_fds;                // most directory fds held open at any one time
+	size_t TOTAL_dirs_reread;          // --since: directories read because they changed
+	size_t TOTAL_dirs_reused;          // --since: directory listings taken from the snapshot
+	blkcnt_t TOTAL_blocks;             // --du: 512-byte blocks of all files and directories
+	size_t TOTAL_dup_links;            // -H: files seen again through another hard link
+	off_t TOTAL_dup_size;              // -H: their size, left out of the deduplicated total
+	size_t TOTAL_mounts_skipped;       // -x: directories on other devices not entered
+	size_t TOTAL_timeouts;             // --timeout: directories given up on
 } ActivityReport;
 
+// Update the maximum depth reached during traversal
+static inline void track_max_depth(ActivityReport *report, int current_depth) {
+    if (report->TOTAL_depth < current_depth) {
+        report->TOTAL_depth = current_depth;
+    }
+}
+
+// ------------------------------ Fd Budget ------------------------------------
+// Tracks the directory fds held by DirFrames on the stack (see -F).
+typedef struct FdBudget {
+	int limit;                         // max fds frames may hold before the oldest is evicted
+	int in_use;                        // directory fds currently open
+	int floor;                         // stack index below which no frame holds an fd
+} FdBudget;
+
 
 #endif
 
@@ -80,7 +191,10 @@ Legend:
   current      : Pointer to the next subdirectory to process in subdirs.
   sp           : Stack pointer; points to the next free slot in the stack.
   is_symlink   : Indicates whether a directory entry is a symlink.
-  ancestor_siblings[] : Array used for drawing tree structure correctly.
+  ancestor_siblings[] : Array used for drawing tree structure correctly. A single
+                        array indexed by depth is shared by every frame: entries
+                        below a frame's depth belong to its ancestors, which don't
+                        change them until that frame has been popped.
 
 ================================================================================
 Notes for Understanding:
@@ -89,7 +203,32 @@ Notes for Understanding:
 - Phase 2 = "Process": traverse subdirectories using the stack.
 - This approach avoids actual recursion, giving better control over stack size.
 - Symlink handling and visited hash prevent infinite loops caused by recursive links.
+  With --visited=ancestors (or auto without -l) there is no hash: a directory is
+  only recursive if it is one of the frames on the stack, which is searched instead.
 - ancestor_siblings[] ensures proper tree drawing even with deep nested directories.
+- With -P N, worker threads (scan_pool.c) run Phase 1 for directories ahead of
+  the main loop. The main loop still does everything else in the same order, so
+  the output is unchanged; a frame with a finished ScanJob adopts its result
+  instead of reading the directory itself.
+- The main loop lives in walk.c (libgtree.a, see walk.h) and holds all of its state
+  in a Walk, so other programs can run walks of their own. It prints nothing: it
+  reports each directory, file and subdirectory to a WalkVisitor, and the command's
+  tree printer in gtree.c is one such visitor.
+- --watch (watch.c) records each walk as a snapshot in memory and prints from it.
+  Changes (inotify on Linux) trigger a new walk with that snapshot as --since, in
+  which directories inotify reported file changes in are invalidated first. As every
+  other directory is watched, a subtree without an invalidated one is copied from
+  the snapshot whole (snapshot_copy_subtree), so only the path down to each change
+  is opened. --du totals are added up when the tree is printed.
+- --breadth-first replaces the stack with two levels of frames (walk_levels): a
+  subdirectory is scanned and reported when its parent's Phase 2 reaches it, and
+  its own Phase 2 runs with the rest of its level. Loops are caught by the hash.
+- At the depth limit a plain directory is only listed. When nothing needs its
+  dev/ino (no hash, -x, snapshot or -S) Phase 2 skips its stat() as well.
+- Several starting directories get a Walk each, one thread per device running its
+  walks in turn, printing into temporary files that gtree.c copies out in order.
+  output.c's buffer and print.c's prefix cache are per thread for this; the walks
+  share one locked hash, which holds all the roots from the start.
 
 ================================================================================
 High-level Algorithm:
@@ -118,31 +257,38 @@ High-level Algorithm:
 	the stack array and DirFrame pointers play the same role.
         
 
-   b) Phase 1: Scan Current Directory (only if subdirs == NULL)
+   b) Phase 1: Scan Current Directory (only if not printed yet)
         - Read entries with readdir().
-        - Skip "." and "..".
-        - Build full path for each entry.
-        - lstat() for symlink info, stat() for actual file type.
+        - Skip "." and "..", hidden entries (unless -j) and --exclude/--include
+          mismatches, by name before any stat() (filter.c).
+        - Stat each entry by name relative to the directory fd (fstatat), so
+          the kernel never re-resolves the full path.
+        - If neither -f, -s nor --sort=mtime is set, classify the entry from d_type where the
+          filesystem provides it (no stat calls needed).
+        - Otherwise fstatat(AT_SYMLINK_NOFOLLOW) for symlink info, and a
+          following fstatat() for the actual file type of symlinks.
         - Handle files (update file count/size, print if requested).
         - For directories or symlinked directories:
             * Check if already visited (loop prevention).
-            * If not visited, create SubDirNode and append to subdirs list.
-        - Set frame->subdirs = head of SubDirNode list.
-        - Set frame->current = head.
+            * If not visited, append a SubDirNode to the subdirs array.
+        - Close the directory stream; keep a dup of its fd only if there are
+          subdirectories to open (subject to the -F fd budget).
+        - Sort the subdirs and files arrays once if --sort asks for an order.
+        - Set frame->current = 0.
         - Print current directory line.
         - Print files if requested.
 
    c) Phase 2: Process Next Subdirectory
-        - If frame->current != NULL:
+        - If frame->current < frame->subdir_count:
             * Take current SubDirNode.
-            * Advance frame->current to next node.
+            * Advance frame->current to the next index.
             * Determine if this is the last child.
             * Update ancestor_siblings[] for correct tree drawing.
-            * Perform stat() to get directory info.
+            * Use the dev/ino cached in Phase 1 (stat() only if not cached, or -S).
             * If symlink:
                 - Print entry line with target path.
                 - Traverse if not already visited and follow_links enabled:
-                    + Create new DirFrame for child directory.
+                    + Create new DirFrame for child directory (openat on parent fd).
                     + Push onto stack.
                     + Increment TOTAL_directories.
                     + Track max depth.
@@ -152,10 +298,11 @@ High-level Algorithm:
                 - Push onto stack.
                 - Increment TOTAL_directories.
                 - Track max depth.
-        - Else (frame->current == NULL):
+        - Else (every subdirectory processed):
             * Directory fully processed.
             * Pop frame from stack.
-            * Close directory and free memory (subdirs list + frame).
+            * Close directory fd (if still held) and reset the frame's arena
+              (subdirs list + frame).
 
 3. Loop ends when stack is empty.
 4. Cleanup:
@@ -163,6 +310,43 @@ High-level Algorithm:
 5. Print summary statistics:
     - Total directories, linked directories, files, total file size, max depth.
 
+--save-snapshot records each printed line (directory, link or file, with size and
+dev/ino) in snapshot.c as it is printed, walking with -j -f at full depth and
+printing nothing. --load-snapshot skips the walk entirely: snapshot_render() replays
+the recorded lines through the same Phase 1 / Phase 2 decisions and print.c code,
+applying -d/-j/-f/-s on the way (-l must be as saved: snapshot_load() checks the
+header); with --du it keeps a frame per depth and prints each directory when the
+next entry at its depth or above comes up.
+
+--since looks every directory up in an earlier snapshot by dev/ino when its frame is
+created. If mtime and ctime still match, Phase 1 takes the listing (subdirectories,
+files, file count/size) from the snapshot instead of reading the directory. Phase 2
+still stat()s each subdirectory, so every listing is checked on its own.
+
+--du walks the whole tree whatever -d says (-d then only limits what is printed) and
+prints each directory line when its frame is popped, after its subtree, like du. On
+pop, the frame's own files are added to its tree_* totals, which already hold its
+subdirectories' totals and its own blocks, and the result is added to its parent.
+-H queues the files with st_nlink > 1 that a scan counted (DirFrame.linked); before
+the directory line is printed the main loop checks each against a dev/ino set in
+visit_hash.c and takes repeated ones back out of the directory's size, so the first
+name reached in walk order counts, also with -P.
+
+--top N keeps the same totals (without changing the output) and offers each file,
+directory and completed subtree to fixed size heaps in top.c.
+
+--timing times every opendir/readdir/lstat/stat/readlink into per-thread tables in
+timing.c, and each frame's open+read time into scan_ns, from which the main loop
+keeps the slowest directories. --timeout checks the same clock between entries:
+once a directory's deadline has passed, scan_directory() drops what it read of it
+(and the totals it added) and marks the frame timed_out. A single call that never
+returns still blocks, but the walk moves on as soon as it does.
+
+Phase 1 reads entries with readdir() and stats them one at a time. Built with
+make SCAN_BACKEND=uring (Linux), scan.c instead reads getdents64() batches and
+issues each batch's stat calls together through io_uring (uring.c), processing the
+results in directory order so the output is identical.
+
 ================================================================================
 Example Stack Visualization (simplified):
 ================================================================================
@@ -5,6 +5,7 @@
 #include <sys/stat.h>   // For struct stat, lstat, stat, S_ISDIR, S_ISLNK (POSIX)
 #include <libgen.h>     // For basename if needed (not used here)
 #include <unistd.h>     // For readlink (POSIX)
+#include <getopt.h>     // For getopt_long
 #include <inttypes.h>   // For intmax_t
 #include "option_parsing.h"
 #include "gtree.h"
@@ -30,20 +31,119 @@ HelpDef help_table[] = {
 	{"-f",   "Show individual Files"},	
 	{"-C",   "Show sym-links in Colour"},	
 	{"-c",   "Show files in Colour (automatically sets -f)"},	
+	{"-S",   "Strict: re-stat directories before descending (for trees that change during the walk)"},
     {"-d N", "Set maximum Depth to descend (will always run to a minimum of 1)"},
+    {"-F N", "Maximum directory File descriptors to hold open (default 64, minimum 2)"},
+    {"-P N", "Parallel: scan directories ahead with N worker threads (output is unchanged)"},
+    {"-H",   "Count files with several Hard links once (sizes, --du and totals); the summary\n"
+             "\tshows both the apparent and the deduplicated size"},
+    {"-x",   "Stay on one file system: don't descend into directories on other devices\n"
+             "\t(mount points are listed but not entered). Also --one-file-system"},
+    {"-u",   "Unbuffered: flush output after every directory (for interactive use)"},
+    {"-q",   "Quiet: print only the summary. Everything is counted as usual (-f/-s/--du totals,\n"
+             "\t--top, --devices), but no line is formatted and -f keeps no file list.\n"
+             "\tAlso --summary-only"},
+    {"-o F", "Output format: tree (default), json, ndjson or null (NUL separated fields:\n"
+             "\tpath, depth, type, size, target, flags). Summary goes to stderr. In json and\n"
+             "\tndjson, bytes of names that aren't valid UTF-8 are shown as \\ufffd (null keeps\n"
+             "\tnames exactly as they are)"},
+    {"--save-snapshot FILE", "Walk everything (incl. hidden entries and files) and save it to FILE\n"
+             "\tinstead of printing. Honours -l, -S, -F and -P"},
+    {"--load-snapshot FILE", "Print the tree saved in FILE instead of walking a directory\n"
+             "\t(-d, -f, -s, -j, -C, -c, -o and --du apply as usual; -l has to be given if,\n"
+             "\tand only if, FILE was saved with it)"},
+    {"--since FILE", "Only read directories whose mtime/ctime changed since snapshot FILE was\n"
+             "\tsaved; the others are listed from it (file sizes as saved). Disables -P.\n"
+             "\t-l has to be given if, and only if, FILE was saved with it"},
+    {"--sort=KEY", "Order entries by name (byte order), size (files largest first) or mtime\n"
+             "\t(newest first); none (default) keeps directory order"},
+    {"--du", "Disk usage: show recursive file count, size and allocated space of every\n"
+             "\tdirectory, printed after its subtree. Walks everything; -d limits the lines shown"},
+    {"--top N", "After the summary, list the N largest files, and the N largest directories\n"
+             "\tby their own files and by their whole subtree"},
+    {"--devices", "Break the summary down by device: directories, files and file size on each\n"
+             "\t(files count on the device of the directory listing them)"},
+    {"--exclude PAT", "Skip entries whose name matches the glob PAT (e.g. .git, '*.o'), before\n"
+             "\tany stat(); excluded directories are never opened. Repeatable"},
+    {"--include PAT", "Only count and list files whose name matches the glob PAT; directories\n"
+             "\tare still walked. Repeatable"},
+    {"--timing[=K]", "After the summary, show the time spent in opendir/readdir/lstat/stat/readlink\n"
+             "\t(totals and a histogram) and the K (default 10) slowest directories. The\n"
+             "\tsummary also shows the peak directory fds held and the stat() calls d_type saved"},
+    {"--timeout MS", "Give up on a directory still being read after MS milliseconds: it is listed\n"
+             "\tas [timeout], without its contents. Checked between entries"},
+    {"--visited=MODE", "Directories remembered to detect loops: all (default) marks every repeat\n"
+             "\t[recursive]; ancestors only the ones being walked (a loop), in memory bounded by\n"
+             "\tthe depth, listing other repeats again; auto is all with -l, else ancestors"},
+    {"--expect-dirs N", "Size the visited set for about N directories up front (by default it grows;\n"
+             "\t--since and --watch take the count from the snapshot)"},
+    {"--no-link-targets", "Show symlinks without their targets (no readlink() at all); records\n"
+             "\tleave out \"target\""},
+    {"--breadth-first", "Walk level by level: every directory at depth 1, then depth 2, ... Memory\n"
+             "\tgrows with the widest level instead of the deepest path. Record formats only\n"
+             "\t(-o json, ndjson or null); implies --visited=all"},
+    {"--progress[=MS]", "Every MS ms (default 1000) show on stderr the directories, files (and\n"
+             "\tsize) found so far, entries per second, and the depth and path reached"},
+    {"--stats-json FILE", "Write the summary totals, the walk's duration and the time spent in each\n"
+             "\tkind of file system call as JSON to FILE (- for stdout: the text summary then\n"
+             "\tgoes to stderr, so with -q stdout holds only the JSON)"},
+    {"--checkpoint FILE", "Save the state of the walk to FILE every minute (see --checkpoint-every),\n"
+             "\tso that a walk that is killed can carry on with --resume. Removed once done"},
+    {"--checkpoint-every MS", "Interval between --checkpoint saves (default 60000)"},
+    {"--resume FILE", "Carry on with the walk saved in --checkpoint FILE, given the same options\n"
+             "\tand no directory. Output appended (>>) to the interrupted run's is cut back to\n"
+             "\tthe checkpoint first, so it ends up as if the walk had never stopped"},
+    {"--watch[=MS]", "Keep running: print the tree, then again whenever it changes (inotify on\n"
+             "\tLinux, collecting changes for MS ms, default 500; elsewhere re-checked every MS).\n"
+             "\tOnly changed directories are read again; with inotify the unchanged subtrees are\n"
+             "\ttaken from memory without opening them. --du totals are added up from memory"},
     {NULL, NULL} // sentinel: marks the end of the array
 };
 
 // List of supported options for getopt(). 'd:' means -d requires an argument.
-const char option_list[] = "hvsljfCcd:";
+const char option_list[] = "hvsljfCcSuHxqd:F:P:o:";
+
+// Long options, returning values outside the char range
+enum { OPT_SAVE_SNAPSHOT = 256, OPT_LOAD_SNAPSHOT, OPT_SINCE, OPT_SORT, OPT_DU, OPT_TOP, OPT_EXCLUDE, OPT_INCLUDE, OPT_DEVICES,
+       OPT_TIMING, OPT_TIMEOUT, OPT_WATCH, OPT_VISITED, OPT_EXPECT_DIRS,
+       OPT_BREADTH_FIRST, OPT_NO_LINK_TARGETS, OPT_PROGRESS, OPT_STATS_JSON, OPT_CHECKPOINT,
+       OPT_CHECKPOINT_EVERY, OPT_RESUME };
+static const struct option long_options[] = {
+    {"save-snapshot", required_argument, NULL, OPT_SAVE_SNAPSHOT},
+    {"load-snapshot", required_argument, NULL, OPT_LOAD_SNAPSHOT},
+    {"since", required_argument, NULL, OPT_SINCE},
+    {"sort", required_argument, NULL, OPT_SORT},
+    {"du", no_argument, NULL, OPT_DU},
+    {"top", required_argument, NULL, OPT_TOP},
+    {"exclude", required_argument, NULL, OPT_EXCLUDE},
+    {"include", required_argument, NULL, OPT_INCLUDE},
+    {"one-file-system", no_argument, NULL, 'x'},
+    {"summary-only", no_argument, NULL, 'q'},
+    {"devices", no_argument, NULL, OPT_DEVICES},
+    {"timing", optional_argument, NULL, OPT_TIMING},
+    {"timeout", required_argument, NULL, OPT_TIMEOUT},
+    {"watch", optional_argument, NULL, OPT_WATCH},
+    {"visited", required_argument, NULL, OPT_VISITED},
+    {"expect-dirs", required_argument, NULL, OPT_EXPECT_DIRS},
+    {"breadth-first", no_argument, NULL, OPT_BREADTH_FIRST},
+    {"no-link-targets", no_argument, NULL, OPT_NO_LINK_TARGETS},
+    {"progress", optional_argument, NULL, OPT_PROGRESS},
+    {"stats-json", required_argument, NULL, OPT_STATS_JSON},
+    {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+    {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+    {"resume", required_argument, NULL, OPT_RESUME},
+    {NULL, 0, NULL, 0}
+};
 
 // Parses command line arguments using POSIX getopt() and sets the Options struct.
 void parse_options(int argc, char *argv[], Options *opts, int default_depth, int *first_file_index) {
     *opts = (Options){0};           	 // Initialize all fields to 0 / false
     opts->max_depth = default_depth;     // Default max depth
+    opts->fd_budget = DEFAULT_FD_BUDGET; // Default directory fd budget
+    opts->checkpoint_ms = DEFAULT_CHECKPOINT_MS;
     int opt;
     // Loop through options using getopt. getopt returns -1 when no more options are found.
-    while ((opt = getopt(argc, argv, option_list)) != -1) { 
+    while ((opt = getopt_long(argc, argv, option_list, long_options, NULL)) != -1) { 
         switch (opt) {
             case 'h': opts->show_help = true; break;
             case 'v': opts->show_version = true; break;
@@ -53,6 +153,11 @@ void parse_options(int argc, char *argv[], Options *opts, int default_depth, int
             case 'f': opts->show_files = true; break;
             case 'C': opts->colour_links = true; break;
             case 'c': opts->colour_files = true; opts->show_files = true; break;
+            case 'S': opts->strict = true; break;
+            case 'u': opts->flush_on_dir = true; break;
+            case 'H': opts->dedup_links = true; break;
+            case 'x': opts->one_file_system = true; break;
+            case 'q': opts->summary_only = true; break;
             case 'd': {
                 int n = atoi(optarg);        // optarg holds the argument for the current option (-d N)
                 if (n < 1) n = 1;            // Enforce minimum depth
@@ -60,12 +165,207 @@ void parse_options(int argc, char *argv[], Options *opts, int default_depth, int
                 opts->max_depth = n;
                 break;
 			}
+            case 'F': {
+                int n = atoi(optarg);
+                if (n < 2) n = 2;            // parent + child are needed for an openat()
+                opts->fd_budget = n;
+                break;
+			}
+            case 'P': {
+                int n = atoi(optarg);
+                if (n < 0) n = 0;            // 0 = serial scan
+                if (n > MAX_SCAN_THREADS) n = MAX_SCAN_THREADS;
+                opts->parallel = n;
+                break;
+			}
+            case 'o':
+                if (!strcmp(optarg, "tree")) opts->output_format = OUTPUT_TREE;
+                else if (!strcmp(optarg, "json")) opts->output_format = OUTPUT_JSON;
+                else if (!strcmp(optarg, "ndjson")) opts->output_format = OUTPUT_NDJSON;
+                else if (!strcmp(optarg, "null")) opts->output_format = OUTPUT_NULL;
+                else {
+                    fprintf(stderr, "Unknown output format: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_SAVE_SNAPSHOT: opts->save_snapshot = optarg; break;
+            case OPT_LOAD_SNAPSHOT: opts->load_snapshot = optarg; break;
+            case OPT_SINCE: opts->since = optarg; break;
+            case OPT_SORT:
+                if (!strcmp(optarg, "none")) opts->sort = SORT_NONE;
+                else if (!strcmp(optarg, "name")) opts->sort = SORT_NAME;
+                else if (!strcmp(optarg, "size")) opts->sort = SORT_SIZE;
+                else if (!strcmp(optarg, "mtime")) opts->sort = SORT_MTIME;
+                else {
+                    fprintf(stderr, "Unknown sort order: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_DU: opts->du = true; break;
+            case OPT_TOP: {
+                int n = atoi(optarg);
+                if (n < 1) n = 1;
+                opts->top = (size_t)n;
+                break;
+			}
+            case OPT_DEVICES: opts->show_devices = true; break;
+            case OPT_TIMING: {
+                int n = optarg ? atoi(optarg) : DEFAULT_SLOWEST_DIRS;
+                if (n < 1) n = 1;
+                opts->timing = (size_t)n;
+                break;
+			}
+            case OPT_TIMEOUT: {
+                int n = atoi(optarg);
+                if (n < 1) n = 1;
+                opts->timeout_ns = (uint64_t)n * 1000000u;
+                break;
+			}
+            case OPT_WATCH: {
+                int n = optarg ? atoi(optarg) : DEFAULT_WATCH_MS;
+                if (n < 1) n = 1;
+                opts->watch_ms = n;
+                break;
+			}
+            case OPT_VISITED:
+                if (!strcmp(optarg, "all")) opts->visited = VISITED_ALL;
+                else if (!strcmp(optarg, "auto")) opts->visited = VISITED_AUTO;
+                else if (!strcmp(optarg, "ancestors")) opts->visited = VISITED_ANCESTORS;
+                else {
+                    fprintf(stderr, "Unknown visited mode: %s\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPT_EXPECT_DIRS: {
+                long long n = atoll(optarg);
+                opts->expect_dirs = n > 0 ? (size_t)n : 0;
+                break;
+			}
+            case OPT_BREADTH_FIRST:
+                opts->breadth_first = true;
+                break;
+            case OPT_NO_LINK_TARGETS:
+                opts->no_link_targets = true;
+                break;
+            case OPT_PROGRESS: {
+                int n = optarg ? atoi(optarg) : DEFAULT_PROGRESS_MS;
+                if (n < 1) n = 1;
+                opts->progress_ms = n;
+                break;
+			}
+            case OPT_STATS_JSON:
+                opts->stats_json = optarg;
+                break;
+            case OPT_CHECKPOINT:
+                opts->checkpoint = optarg;
+                break;
+            case OPT_CHECKPOINT_EVERY: {
+                int n = atoi(optarg);
+                if (n < 1) n = 1;
+                opts->checkpoint_ms = n;
+                break;
+			}
+            case OPT_RESUME:
+                opts->resume = optarg;
+                break;
+            case OPT_EXCLUDE:
+                if (!opts->exclude) opts->exclude = filter_create();
+                filter_add(opts->exclude, optarg);
+                break;
+            case OPT_INCLUDE:
+                if (!opts->include) opts->include = filter_create();
+                filter_add(opts->include, optarg);
+                break;
             default:
                 fprintf(stderr, "Unknown option: -%c\n", optopt);
                 exit(EXIT_FAILURE);
         }
     }
 
+    if (opts->load_snapshot &&
+        (opts->save_snapshot || opts->since || opts->top || opts->dedup_links)) {
+        fprintf(stderr, "--load-snapshot can't be combined with --save-snapshot, --since, --top or -H\n");
+        exit(EXIT_FAILURE);
+    }
+    // Nothing but the summary: the records are dropped, -f only counts (as -s does)
+    // and link targets are never shown
+    if (opts->summary_only) {
+        if (opts->watch_ms) {
+            fprintf(stderr, "--watch can't be combined with -q\n");
+            exit(EXIT_FAILURE);
+        }
+        opts->output_format = OUTPUT_NONE;
+        if (opts->show_files) {
+            opts->show_files = false;
+            opts->show_file_stats = true;
+        }
+        if (!opts->save_snapshot) opts->no_link_targets = true;
+    }
+
+    if (opts->load_snapshot && opts->progress_ms) {
+        fprintf(stderr, "--progress can't be combined with --load-snapshot: nothing is walked\n");
+        exit(EXIT_FAILURE);
+    }
+    // A snapshot has to be complete for --since to trust it
+    if (opts->timeout_ns && opts->save_snapshot) {
+        fprintf(stderr, "--timeout can't be combined with --save-snapshot\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Updates are printed from the kept tree, which has no link counts, devices or call times
+    if (opts->watch_ms && (opts->save_snapshot || opts->load_snapshot || opts->since ||
+                           opts->top || opts->dedup_links || opts->show_devices || opts->timing ||
+                           opts->timeout_ns || opts->progress_ms || opts->stats_json)) {
+        fprintf(stderr, "--watch can't be combined with --save-snapshot, --load-snapshot, --since,\n"
+                        "--top, -H, --devices, --timing, --timeout, --progress or --stats-json\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Several roots are walked at once, each on its own: a snapshot holds one tree, and
+    // their progress lines would overwrite each other
+    if (argc - optind > 1 && (opts->save_snapshot || opts->load_snapshot || opts->since ||
+                              opts->watch_ms || opts->progress_ms)) {
+        fprintf(stderr, "Several starting directories can't be combined with --save-snapshot,\n"
+                        "--load-snapshot, --since, --watch or --progress\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // A checkpoint is the stack of a depth-first walk, its totals and visited sets; the
+    // printer's own tables (--top, --devices) and the call times aren't kept
+    if ((opts->checkpoint || opts->resume) &&
+        (opts->breadth_first || opts->save_snapshot || opts->load_snapshot || opts->since ||
+         opts->watch_ms || opts->top || opts->show_devices || opts->timing || opts->stats_json)) {
+        fprintf(stderr, "--checkpoint and --resume can't be combined with --breadth-first, --save-snapshot,\n"
+                        "--load-snapshot, --since, --watch, --top, --devices, --timing or --stats-json\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opts->checkpoint && argc - optind > 1) {
+        fprintf(stderr, "--checkpoint takes one starting directory\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opts->resume && optind < argc) {
+        fprintf(stderr, "--resume takes the starting directory from %s\n", opts->resume);
+        exit(EXIT_FAILURE);
+    }
+
+    // Level order can't be drawn as a tree, and without an ancestor stack only the
+    // visited set stops loops. --du/--top total subtrees as they are left, depth first.
+    if (opts->breadth_first && opts->output_format == OUTPUT_TREE) {
+        fprintf(stderr, "--breadth-first lists level by level, which a tree can't show: "
+                        "use -o json, ndjson or null\n");
+        exit(EXIT_FAILURE);
+    }
+    if (opts->breadth_first && (opts->du || opts->top || opts->save_snapshot || opts->watch_ms ||
+                                opts->visited == VISITED_ANCESTORS)) {
+        fprintf(stderr, "--breadth-first can't be combined with --du, --top, --save-snapshot, --watch\n"
+                        "or --visited=ancestors\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The totals need the whole tree, so -d only limits what --du prints
+    opts->print_depth = opts->max_depth;
+    if (opts->du) opts->max_depth = default_depth;
+
     // After getopt finishes, optind is the index of the first non-option argument (the start path).
     if (optind < argc) *first_file_index = optind;
 	else *first_file_index = -1;  
@@ -78,11 +378,13 @@ void show_version(void){
 
 // Print help message using the help_table
 void show_help(void){
-	fprintf(stderr, "Usage: gtree [options] starting_directory \n");
+	fprintf(stderr, "Usage: gtree [options] [starting_directory ...]\n");
 	fprintf(stderr, "Options:\n");
 	for (HelpDef *opt = help_table; opt->name; opt++) {
 		fprintf(stderr, "  %s\t%s\n", opt->name, opt->help);
 	}
-	fprintf(stderr, "\nIf no starting directory is specified, current directory is assumed.\n");
+	fprintf(stderr, "\nIf no starting directory is specified, current directory is assumed.\n"
+	                "Several are walked at the same time (one after another on each device) and\n"
+	                "shown in order, each with its totals, then the totals of them all.\n");
 	show_version();
 }
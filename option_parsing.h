@@ -2,6 +2,33 @@
 #define OPTION_PARSING_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filter.h"
+
+// Output formats selectable with -o
+typedef enum {
+    OUTPUT_TREE = 0,        // box-drawing tree (default)
+    OUTPUT_JSON,            // one JSON array of records
+    OUTPUT_NDJSON,          // one JSON record per line
+    OUTPUT_NULL,            // NUL separated fields
+    OUTPUT_NONE             // no records (--save-snapshot)
+} OutputFormat;
+
+// Entry orders selectable with --sort
+typedef enum {
+    SORT_NONE = 0,          // directory order (default)
+    SORT_NAME,              // byte order of names
+    SORT_SIZE,              // files largest first, directories by name
+    SORT_MTIME              // newest first
+} SortOrder;
+
+// Directories remembered for loop detection, selectable with --visited
+typedef enum {
+    VISITED_ALL = 0,        // every directory reached (default)
+    VISITED_AUTO,           // all of them with -l, else only the ones being walked
+    VISITED_ANCESTORS       // only the directories being walked: O(depth) memory
+} VisitedMode;
 
 // Structure to hold all parsed command-line options
 typedef struct {
@@ -13,7 +40,37 @@ typedef struct {
     bool show_files;		// -f
     bool colour_links;		// -C
     bool colour_files;		// -c
+    bool strict;			// -S
     int max_depth;   		// -dN
+    int fd_budget;			// -FN
+    int parallel;			// -PN
+    bool flush_on_dir;		// -u
+    bool summary_only;		// -q
+    OutputFormat output_format;	// -o FORMAT
+    const char *save_snapshot;	// --save-snapshot FILE
+    const char *load_snapshot;	// --load-snapshot FILE
+    const char *since;			// --since FILE
+    SortOrder sort;				// --sort=KEY
+    bool du;					// --du
+    int print_depth;			// deepest line printed: -dN, while --du walks everything
+    size_t top;					// --top N
+    bool dedup_links;			// -H
+    bool one_file_system;		// -x
+    bool show_devices;			// --devices
+    NameFilter *exclude;		// --exclude PATTERN (NULL if none given)
+    NameFilter *include;		// --include PATTERN (NULL if none given)
+    size_t timing;				// --timing[=K]: K slowest directories listed (0: off)
+    uint64_t timeout_ns;		// --timeout MS, in ns (0: none)
+    int watch_ms;				// --watch[=MS]: time changes are collected for before each update (0: off)
+    VisitedMode visited;		// --visited=MODE
+    size_t expect_dirs;			// --expect-dirs N: visited set size hint (0: none)
+    bool breadth_first;			// --breadth-first
+    bool no_link_targets;		// --no-link-targets
+    int progress_ms;			// --progress[=MS]: interval between progress lines (0: off)
+    const char *stats_json;		// --stats-json FILE ("-": stdout)
+    const char *checkpoint;		// --checkpoint FILE
+    int checkpoint_ms;			// --checkpoint-every MS: interval between checkpoints
+    const char *resume;			// --resume FILE
 } Options;
 
 void parse_options(int argc, char *argv[], Options *opts, int default_depth, int *first_file_index);
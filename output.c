@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>     // For memcpy, strlen
+#include <unistd.h>     // For write (POSIX)
+#include <errno.h>      // For errno, EINTR
+#include "memsafe.h"
+#include "output.h"
+
+static char out_buf[OUT_BUFFER_SIZE];
+
+// Per thread, so walks of several roots can print at once, each into its own file
+static __thread struct {
+    int fd;                     // Destination (stdout)
+    bool flush_on_dir;          // -u: flush after each directory
+    size_t len;                 // Bytes waiting in buf
+    char *buf;
+} out = { .fd = 1 };
+
+void out_init(int fd, bool flush_on_dir) {
+    out.fd = fd;
+    out.flush_on_dir = flush_on_dir;
+    out.len = 0;
+    out.buf = out_buf;
+    atexit(out_flush); // don't lose buffered lines on an early exit (e.g. xmalloc failure)
+}
+
+void out_begin_thread(int fd) {
+    out.fd = fd;
+    out.flush_on_dir = false;
+    out.len = 0;
+    out.buf = xmalloc(OUT_BUFFER_SIZE);
+}
+
+void out_end_thread(void) {
+    out_flush();
+    free(out.buf);
+    out.buf = NULL;
+}
+
+// Send further output to a different fd (after flushing what is buffered)
+void out_set_fd(int fd) {
+    out_flush();
+    out.fd = fd;
+}
+
+// Hand everything buffered to the kernel, retrying short and interrupted writes
+void out_flush(void) {
+    size_t done = 0;
+    while (done < out.len) {
+        ssize_t n = write(out.fd, out.buf + done, out.len - done);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            break; // nothing sensible left to do with the output (e.g. closed pipe)
+        }
+        done += (size_t)n;
+    }
+    out.len = 0;
+}
+
+void out_write(const char *s, size_t len) {
+    if (out.len + len > OUT_BUFFER_SIZE) {
+        out_flush();
+        if (len > OUT_BUFFER_SIZE) { // too big to buffer: write straight through
+            size_t done = 0;
+            while (done < len) {
+                ssize_t n = write(out.fd, s + done, len - done);
+                if (n == -1) {
+                    if (errno == EINTR) continue;
+                    return;
+                }
+                done += (size_t)n;
+            }
+            return;
+        }
+    }
+    memcpy(out.buf + out.len, s, len);
+    out.len += len;
+}
+
+void out_puts(const char *s) {
+    out_write(s, strlen(s));
+}
+
+// Format straight into the buffer when it fits, otherwise flush and try again
+void out_printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = OUT_BUFFER_SIZE - out.len;
+    int n = vsnprintf(out.buf + out.len, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t)n < room) {
+        out.len += (size_t)n;
+        return;
+    }
+
+    out_flush();
+    char *tmp = xmalloc((size_t)n + 1);
+    va_start(ap, fmt);
+    vsnprintf(tmp, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    out_write(tmp, (size_t)n);
+    free(tmp);
+}
+
+// Called after each directory's lines have been produced
+void out_dir_done(void) {
+    if (out.flush_on_dir) out_flush();
+}
+
+// perror() that keeps error messages in order with the buffered tree output
+void out_perror(const char *s) {
+    int saved = errno;
+    out_flush();
+    errno = saved;
+    perror(s);
+}
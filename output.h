@@ -0,0 +1,29 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// -------------------- Buffered output writer --------------------
+// All tree and summary output goes through one large buffer that is handed to
+// the kernel with a single write() whenever it fills, instead of several small
+// stdio calls per line. out_dir_done() additionally flushes after every
+// directory when flush-on-directory (-u) was requested, for interactive use.
+// The buffer is the calling thread's: out_init() sets up the main thread's, and
+// any other thread that prints brackets its output with out_begin/end_thread().
+
+#define OUT_BUFFER_SIZE (64 * 1024)
+
+void out_init(int fd, bool flush_on_dir);
+void out_begin_thread(int fd);
+// Flushes the thread's output and frees its buffer
+void out_end_thread(void);
+void out_set_fd(int fd);
+void out_write(const char *s, size_t len);
+void out_puts(const char *s);
+void out_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void out_flush(void);
+void out_dir_done(void);
+void out_perror(const char *s);
+
+#endif
@@ -5,62 +5,283 @@
 #include <string.h>     // For strncpy, strcmp, strrchr, memset, memcpy, snprintf
 #include <sys/stat.h>   // For struct stat, lstat, stat, S_ISDIR, S_ISLNK (POSIX)
 #include <libgen.h>     // For basename if needed (not used here)
-#include <unistd.h>     // For readlink (POSIX)
+#include <unistd.h>     // For readlinkat (POSIX)
 #include <inttypes.h>   // For intmax_t
 #include "gtree.h"
 #include "memsafe.h"
 #include "print.h"
 #include "option_parsing.h"
+#include "output.h"
 
 
 // ----------------- Human readable file size -------------------
 // Converts a size in bytes (off_t) to a human-readable string (e.g., 4.5K, 2.1M).
+// Integers only, as it runs for every file line: bytes / 1024^u to one decimal,
+// rounded to nearest with ties to even, which is what "%.1f" made of the exact quotient.
+static char *put_digits(char *p, uintmax_t v)
+{
+    do *--p = (char)('0' + v % 10); while (v /= 10);
+    return p;
+}
+
 void human_size(off_t bytes, char *out, size_t outsz){
-    const char *units[] = {"B", "K", "M", "G", "T"};
-    double size = (double)bytes;
+    static const char units[] = "BKMGT";
+    char buf[32];
+    char *p = buf + sizeof(buf);
+    uintmax_t b = bytes < 0 ? -(uintmax_t)bytes : (uintmax_t)bytes;
     int u = 0;
-    // Loop while size is >= 1024 and we have a unit to move up to
-    while (size >= 1024.0 && u < 4) {
-        size /= 1024.0;
+    // Move up a unit while the size is >= 1024 of the current one
+    while (bytes > 0 && u < 4 && b >> (10 * u) >= 1024)
         u++;
+    *--p = '\0';
+    *--p = units[u];
+    if (u == 0) {
+        p = put_digits(p, b);
+    } else {
+        unsigned shift = 10 * (unsigned)u;
+        uintmax_t mask = ((uintmax_t)1 << shift) - 1, half = (uintmax_t)1 << (shift - 1);
+        uintmax_t rem10 = (b & mask) * 10;
+        uintmax_t tenths = (b >> shift) * 10 + (rem10 >> shift);
+        uintmax_t left = rem10 & mask;
+        if (left > half || (left == half && (tenths & 1))) tenths++;
+        *--p = (char)('0' + tenths % 10);
+        *--p = '.';
+        p = put_digits(p, tenths / 10);
+    }
+    if (bytes < 0) *--p = '-';
+    size_t len = (size_t)(buf + sizeof(buf) - p);
+    if (outsz == 0) return;
+    if (len > outsz) {
+        len = outsz;
+        p[len - 1] = '\0';
     }
-    // Format the output string with 1 decimal place and the unit
-    snprintf(out, outsz, (u == 0) ? "%.0f%s" : "%.1f%s", size, units[u]);
+    memcpy(out, p, len);
 }
 
 // ----------------- Printing helpers -------------------
+// The "│   " / "    " prefix only depends on ancestor_siblings[1..depth-1], which
+// siblings (and the files listed under them) share, so it is built incrementally
+// and cached: segments 1..prefix_valid are correct for the array prefix_owner.
+// set_ancestor_sibling() is the only writer and invalidates from that depth on.
+// Like the output buffer, the cache is per thread (several roots print at once).
+#define PREFIX_SEGMENT_MAX 6    // strlen("│   ")
+static __thread char prefix_buf[(MAX_DEPTH + 2) * PREFIX_SEGMENT_MAX];
+static __thread size_t prefix_end[MAX_DEPTH + 2];    // byte offset after segment i
+static __thread int prefix_valid = 0;
+static __thread const bool *prefix_owner = NULL;
+
+void set_ancestor_sibling(const DirFrame *frame, int depth, bool has_more_siblings)
+{
+    frame->ancestor_siblings[depth] = has_more_siblings;
+    if (frame->ancestor_siblings == prefix_owner && prefix_valid >= depth)
+        prefix_valid = depth - 1;
+}
+
 static void print_tree_prefix(const DirFrame *frame)
 {
-    if (!frame) return;
-    for (int i = 1; i < frame->depth; i++)
-        printf("%s", frame->ancestor_siblings[i] ? "│   " : "    ");
+    if (!frame || frame->depth <= 1) return;
+    if (frame->ancestor_siblings != prefix_owner) { // different tree: start again
+        prefix_owner = frame->ancestor_siblings;
+        prefix_valid = 0;
+    }
+    for (int i = prefix_valid + 1; i < frame->depth; i++) {
+        const char *seg = frame->ancestor_siblings[i] ? "│   " : "    ";
+        size_t len = strlen(seg);
+        memcpy(prefix_buf + prefix_end[i - 1], seg, len);
+        prefix_end[i] = prefix_end[i - 1] + len;
+    }
+    if (prefix_valid < frame->depth - 1)
+        prefix_valid = frame->depth - 1;
+    out_write(prefix_buf, prefix_end[frame->depth - 1]);
 }
 
+// du: the popped frame whose --du subtree totals are appended, else NULL
 static void print_directory_content(const char *name, bool is_symdir,
-                            const char *symPath, bool is_recursive,
-                            size_t fc, off_t fs, Options *opts)
+                            const char *symPath, bool is_recursive, bool timed_out,
+                            size_t fc, off_t fs, const DirFrame *du, Options *opts)
 {
+    char hsize[32];
+    char hdisk[32];
+    if (du) {
+        human_size(du->tree_file_size, hsize, sizeof(hsize));
+        human_size((off_t)du->tree_blocks * 512, hdisk, sizeof(hdisk));
+    }
+
     if (is_symdir) {
         const char *TCOL  = "\033[1;32m";  // ANSI 33m cyan; 34 blue, 31 red, 32 green, 36 cyan
 	    const char *RESET = "\033[0m";   // reset to default color
 
-        printf("%s@%s -> %s%s%s\n", 
-        		opts->colour_links ? TCOL : "", 
-        		name, symPath,
-        		opts->colour_links ? RESET : "", 
-               	is_recursive ? " [recursive]" : "");
+        if (opts->colour_links) out_puts(TCOL);
+        out_puts("@");
+        out_puts(name);
+        if (symPath) {
+            out_puts(" -> ");
+            out_puts(symPath);
+        }
+        if (opts->colour_links) out_puts(RESET);
+        if (du) out_printf(" [Total: %zu files, %s] [Disk: %s]", du->tree_file_count, hsize, hdisk);
+        if (timed_out) out_puts(" [timeout]");
+        out_puts(is_recursive ? " [recursive]\n" : "\n");
         return;
     }
 
+    out_puts(name);
     if (opts->show_file_stats && fc > 0) {
-        char hsize[32];
-        human_size(fs, hsize, sizeof(hsize));
-        printf("%s [Files: %zu] [Size: %s]%s\n", name, fc, hsize,
-               is_recursive ? " [recursive]" : "");
-    } else {
-        printf("%s%s\n", name,
-               is_recursive ? " [recursive]" : "");
+        char fsize[32];
+        human_size(fs, fsize, sizeof(fsize));
+        out_printf(" [Files: %zu] [Size: %s]", fc, fsize);
+    }
+    if (du) out_printf(" [Total: %zu files, %s] [Disk: %s]", du->tree_file_count, hsize, hdisk);
+    if (timed_out) out_puts(" [timeout]");
+    out_puts(is_recursive ? " [recursive]\n" : "\n");
+}
+
+// Name printed for a directory line: the last path component, or the root as given
+static const char *display_name(const char *path, int depth)
+{
+    const char *slash = strrchr(path, '/');
+    return (slash && depth > 0) ? slash + 1 : path;
+}
+
+// ----------------- Machine readable records (-o) -------------------
+// One record per printed entry, streamed as the tree is walked:
+//   json / ndjson : {"path":..,"depth":..,"type":..,"size":..,"target":..,"recursive":..,"dangling":..}
+//   null          : path, depth, type, size, target, flags - each field NUL terminated
+// type is "dir", "file" or "symlink"; size is only meaningful for files. With --du,
+// directory records carry their subtree's file size, and json/ndjson add
+// "files" and "blocks" (512-byte blocks allocated) for the subtree. json/ndjson
+// strings replace bytes that aren't valid UTF-8 with U+FFFD; null keeps names as is.
+static __thread size_t records_emitted = 0;
+
+// Length of the UTF-8 sequence at s (whose first byte is 0x80 or more), or 0 if it
+// isn't a valid one: overlong, a surrogate, beyond U+10FFFF or cut short
+static size_t utf8_length(const unsigned char *s)
+{
+    size_t len;
+    uint32_t cp, min;
+    if (s[0] >= 0xc2 && s[0] <= 0xdf) { len = 2; cp = s[0] & 0x1f; min = 0x80; }
+    else if ((s[0] & 0xf0) == 0xe0) { len = 3; cp = s[0] & 0x0f; min = 0x800; }
+    else if (s[0] >= 0xf0 && s[0] <= 0xf4) { len = 4; cp = s[0] & 0x07; min = 0x10000; }
+    else return 0;
+    for (size_t i = 1; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80) return 0;
+        cp = cp << 6 | (s[i] & 0x3f);
     }
+    if (cp < min || (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff) return 0;
+    return len;
+}
+
+// Write str with JSON string escaping (without the surrounding quotes). File names
+// are bytes, but JSON text is UTF-8: a byte that isn't part of a valid sequence is
+// written as U+FFFD, so the document always parses.
+static void out_json_escaped(const char *str)
+{
+    const char *run = str;
+    for (const char *c = str; *c; c++) {
+        unsigned char ch = (unsigned char)*c;
+        if (ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\') continue;
+        size_t len = ch >= 0x80 ? utf8_length((const unsigned char *)c) : 0;
+        if (len) {
+            c += len - 1;
+            continue;
+        }
+        out_write(run, (size_t)(c - run));
+        if (ch == '"') out_puts("\\\"");
+        else if (ch == '\\') out_puts("\\\\");
+        else if (ch >= 0x80) out_puts("\\ufffd");
+        else out_printf("\\u%04x", ch);
+        run = c + 1;
+    }
+    out_puts(run);
+}
+
+// path is the entry's full path, or its directory's path when name is given
+static void print_record(const char *path, const char *name, int depth, const char *type,
+                         off_t size, const char *target, bool recursive, bool dangling,
+                         bool timed_out, const DirFrame *du, const Options *opts)
+{
+    if (opts->output_format == OUTPUT_NONE) return;
+    records_emitted++;
+
+    if (opts->output_format == OUTPUT_NULL) {
+        out_puts(path);
+        if (name) { out_puts("/"); out_puts(name); }
+        out_write("", 1);
+        out_printf("%d", depth);
+        out_write("", 1);
+        out_puts(type);
+        out_write("", 1);
+        out_printf("%jd", (intmax_t)size);
+        out_write("", 1);
+        if (target) out_puts(target);
+        out_write("", 1);
+        if (recursive) out_puts("R");
+        if (dangling) out_puts("D");
+        if (timed_out) out_puts("T");
+        out_write("", 1);
+        return;
+    }
+
+    if (opts->output_format == OUTPUT_JSON)
+        out_puts(records_emitted > 1 ? ",\n  " : "  ");
+    out_puts("{\"path\":\"");
+    out_json_escaped(path);
+    if (name) { out_puts("/"); out_json_escaped(name); }
+    out_printf("\",\"depth\":%d,\"type\":\"%s\",\"size\":%jd", depth, type, (intmax_t)size);
+    if (target) {
+        out_puts(",\"target\":\"");
+        out_json_escaped(target);
+        out_puts("\"");
+    }
+    if (du)
+        out_printf(",\"files\":%zu,\"blocks\":%jd", du->tree_file_count, (intmax_t)du->tree_blocks);
+    if (timed_out) out_puts(",\"timeout\":true");
+    out_printf(",\"recursive\":%s,\"dangling\":%s}",
+               recursive ? "true" : "false", dangling ? "true" : "false");
+    if (opts->output_format == OUTPUT_NDJSON)
+        out_puts("\n");
+}
+
+// Start / finish the record stream (the json format is a single array)
+void print_begin(const Options *opts)
+{
+    if (opts->output_format == OUTPUT_JSON) out_puts("[\n");
+}
+
+void print_end(const Options *opts)
+{
+    if (opts->output_format == OUTPUT_JSON) out_puts(records_emitted ? "\n]\n" : "]\n");
+}
+
+size_t print_records(void)
+{
+    return records_emitted;
+}
+
+void print_set_records(size_t n)
+{
+    records_emitted = n;
+}
+
+// ----------------- File lines -------------------
+// Around the text of a file line, after the tree prefix: preserve original
+// formatting, depth==0 ? "" : "    "
+static void file_line_start(int depth, bool is_last, bool is_link, const Options *opts)
+{
+    const char *TCOL1 = "\033[0;36m";  // ANSI 33m cyan; 34 blue, 31 red, 32 green, 36 cyan
+    const char *TCOL2 = "\033[1;33m";  // ANSI 33m 33 yellow 0/1 = normal or bold
+
+    if (depth > 0) out_puts(is_last ? "    " : "│   ");
+    out_puts(": ");
+    if (opts->colour_files) out_puts((is_link && opts->colour_links) ? TCOL2 : TCOL1);
+}
+
+static void file_line_end(const Options *opts)
+{
+    const char *RESET = "\033[0m";   // reset to default color
+
+    if (opts->colour_files) out_puts(RESET);
+    out_puts("\n");
 }
 
 // ----------------- Unified entry printing -------------------
@@ -72,14 +293,23 @@ void print_entry_line(const DirFrame *frame, bool is_last, bool is_symdir,
 					  const char *symPath, bool is_recursive, 
 					  const char *entry_name, bool is_dir, Options *opts) {
 					   
+    if (opts->output_format == OUTPUT_NONE) return;     // --save-snapshot, -q
     const char *basePath = frame ? frame->path : "";
     int depth = frame ? frame->depth : 0;
     const bool *ancestor_siblings = frame ? frame->ancestor_siblings : NULL;
     size_t fc = frame ? frame->dir_file_count : 0;
     off_t fs = frame ? frame->dir_file_size : 0;
+    bool timed_out = frame && frame->timed_out;
+
+    const char *dir_name = display_name(basePath, depth);
 
-    const char *slash = strrchr(basePath, '/');
-    const char *dir_name = (slash && depth > 0) ? slash + 1 : basePath;
+    if (is_dir && depth > opts->print_depth) return;   // below --du's -d
+    if (opts->output_format != OUTPUT_TREE) {
+        if (is_dir)
+            print_record(basePath, NULL, depth, is_symdir ? "symlink" : "dir", 0,
+                         is_symdir ? symPath : NULL, is_recursive, false, timed_out, NULL, opts);
+        return;
+    }
 
     // Print tree prefix (│   / spaces)
     if (ancestor_siblings)
@@ -87,121 +317,73 @@ void print_entry_line(const DirFrame *frame, bool is_last, bool is_symdir,
 
     // --- FILE case: keep the original "    : name" behaviour (no connector) ---
     if (!is_dir) {
-        // preserve original formatting: depth==0 ? "" : "    "
-        const char *TCOL1 = "\033[0;36m";  // ANSI 33m cyan; 34 blue, 31 red, 32 green, 36 cyan
-        const char *TCOL2 = "\033[1;33m";  // ANSI 33m 33 yellow 0/1 = normal or bold
-	    const char *RESET = "\033[0m";   // reset to default color
-
-        printf("%s: " "%s%s%s\n",
-        		depth == 0 ? "" : (is_last ? "    " : "│   "), 
-        		opts->colour_files ? ((is_symdir && opts->colour_links) ? TCOL2 : TCOL1) : "", 
-        		entry_name ? entry_name : "", 
-        		opts->colour_files ? RESET : "");
+        file_line_start(depth, is_last, is_symdir, opts);
+        if (entry_name) out_puts(entry_name);
+        file_line_end(opts);
         return;
     }
 
     // --- DIRECTORY case: print connector + directory content (or symlink) ---
     if (depth > 0)
-        printf("%s── ", is_last ? "└" : "├");
+        out_puts(is_last ? "└── " : "├── ");
 
     // Use dir_name as the printed name for directories
-    print_directory_content(dir_name, is_symdir, symPath, is_recursive, fc, fs, opts);
+    print_directory_content(dir_name, is_symdir, symPath, is_recursive, timed_out, fc, fs, NULL, opts);
 }
 
-// ----------------- File Handling -------------------
-// // Helper functions for maintaining a print_queue forfiles
-
-static void add_subfile(bool is_symlink, char *fname, SubDirFile **tail_ptr){
-	SubDirFile *n = xmalloc(sizeof(SubDirFile));
-	snprintf(n->name, PATH_MAX, "%s", fname);
-	n->is_symlink = is_symlink;
-	n->prev = *tail_ptr;
-	*tail_ptr = n;
-}
+// ----------------- Directory totals (--du) -------------------
+// The line of a directory whose subtree is complete: as print_entry_line() would
+// print it (a followed symlink as the link), with the subtree totals added.
+void print_du_line(const DirFrame *frame, Options *opts)
+{
+    if (frame->depth > opts->print_depth || opts->output_format == OUTPUT_NONE) return;
+    bool is_symdir = frame->is_symlink;
 
-// Free a linked list of subdirectories (SubDirFiles).
-void free_subfiles(SubDirFile *tail) {
-    SubDirFile *cur = tail, *prev;
-    while (cur != NULL) { // Stop when the true 'head' (prev is NULL) is reached
-        prev = cur->prev; 
-        free(cur);
-        cur = prev;
+    if (opts->output_format != OUTPUT_TREE) {
+        print_record(frame->path, NULL, frame->depth, is_symdir ? "symlink" : "dir",
+                     frame->tree_file_size, frame->sym_path, false, false, frame->timed_out, frame, opts);
+        return;
     }
-}
-
-// ----------------- Handle Files -----------------
-// Handle files, symlinks, and dangling links properly
-void HandleFiles(char *fname, DirFrame *frame, struct stat *st, struct stat *lst, 
-                 ActivityReport *report, bool show_files) {
-
-    bool target_is_file = false;
-    bool target_is_dir = false;
-    bool dangling = false;
-    bool is_link;
 
-    // Determine target type if symlink
-    is_link = S_ISLNK(lst->st_mode);
-    if (is_link) {
-        if (st->st_mode == 0) {
-            dangling = true; // stat failed
-        } else if (S_ISDIR(st->st_mode)) {
-            target_is_dir = true;
-        } else if (S_ISREG(st->st_mode)) {
-            target_is_file = true;
-        }
-    }
+    print_tree_prefix(frame);
+    if (frame->depth > 0)
+        out_puts(frame->is_last ? "└── " : "├── ");
+    print_directory_content(display_name(frame->path, frame->depth), is_symdir, frame->sym_path,
+                            false, frame->timed_out, frame->dir_file_count, frame->dir_file_size, frame, opts);
+}
 
-    // Case 1: regular file or symlink to file
-    if ((!is_link && S_ISREG(st->st_mode)) || target_is_file) {
-        frame->dir_file_count++;
-        frame->dir_file_size += st->st_size;
-        report->TOTAL_file_count++;
-        report->TOTAL_file_size += st->st_size;
-        if (is_link) report->TOTAL_linked_files++;
-
-        if (show_files) {
-            char fdet[PATH_MAX] = "";
-            if (is_link) {
-                char target[PATH_MAX] = "";
-                ssize_t len = readlink(fname, target, PATH_MAX - 1);
-                if (len != -1) target[len] = '\0';
-                else target[0] = '\0';
-                snprintf(fdet, PATH_MAX, "@%s (-> %s)", strrchr(fname, '/') + 1, target);
-            } else {
-                char hsize[32];
-                human_size(st->st_size, hsize, sizeof(hsize));
-                snprintf(fdet, PATH_MAX, "%s (%s)", strrchr(fname, '/') + 1, hsize);
-            }
-            add_subfile(is_link, fdet, &(frame->subfiles));
-        }
+// ----------------- File entry printing -------------------
+// Formats a queued file entry at print time: "name (size)", "@link (-> target)"
+// or "@link -> target [dangling]" in the tree, or a record with -o.
+void print_file_line(const DirFrame *frame, const SubDirFile *f, Options *opts)
+{
+    if (frame->depth + 1 > opts->print_depth) return;  // below --du's -d
+    if (opts->output_format == OUTPUT_NONE) return;
+    if (opts->output_format != OUTPUT_TREE) {
+        print_record(frame->path, f->name, frame->depth + 1, f->is_symlink ? "symlink" : "file",
+                     f->size, f->target, false, f->dangling, false, NULL, opts);
         return;
     }
 
-    // Case 2: dangling symlink (file or directory)
-    if (is_link && dangling) {
-        frame->dir_file_count++;
-        report->TOTAL_file_count++;
-        report->TOTAL_linked_files++;
-        if (show_files) {
-            char target[PATH_MAX] = "";
-            ssize_t len = readlink(fname, target, PATH_MAX - 1);
-            if (len != -1) target[len] = '\0';
-            else target[0] = '\0';
-            char fdet[PATH_MAX];
-            snprintf(fdet, PATH_MAX, "@%s -> %s [dangling]", strrchr(fname, '/') + 1, target);
-            add_subfile(true, fdet, &(frame->subfiles));
+    // Written piece by piece straight into the output buffer
+    if (frame->ancestor_siblings) print_tree_prefix(frame);
+    file_line_start(frame->depth, frame->is_last, f->is_symlink, opts);
+    if (f->is_symlink) {
+        out_puts("@");
+        out_puts(f->name);
+        if (f->target) {
+            out_puts(f->dangling ? " -> " : " (-> ");
+            out_puts(f->target);
+            if (!f->dangling) out_puts(")");
         }
-        return;
-    }
-
-    // Case 3: symlink to directory (or directory itself)
-    if (target_is_dir || (!is_link && S_ISDIR(st->st_mode))) {
-        // Don't count as a file; traversal will handle directories
-        return;
+        if (f->dangling) out_puts(" [dangling]");
+    } else {
+        char hsize[32];
+        human_size(f->size, hsize, sizeof(hsize));
+        out_puts(f->name);
+        out_puts(" (");
+        out_puts(hsize);
+        out_puts(")");
     }
-
-    // Otherwise: ignore (non-regular, non-symlink files)
+    file_line_end(opts);
 }
-
-
-
@@ -4,6 +4,7 @@
 #include "option_parsing.h"
 
 void human_size(off_t bytes, char *out, size_t outsz);
+void set_ancestor_sibling(const DirFrame *frame, int depth, bool has_more_siblings);
 void print_entry_line(const DirFrame *frame,
                       bool is_last,
                       bool is_symdir,
@@ -12,8 +13,14 @@ void print_entry_line(const DirFrame *frame,
                       const char *entry_name,
                       bool is_dir,
                       Options *opts);
-void free_subfiles(SubDirFile *tail);
-void HandleFiles(char *fname, DirFrame *frame, struct stat *st, struct stat *lst, 
-			ActivityReport *report, bool show_files);
+void print_file_line(const DirFrame *frame, const SubDirFile *f, Options *opts);
+void print_du_line(const DirFrame *frame, Options *opts);
+void print_begin(const Options *opts);
+void print_end(const Options *opts);
+// Records the calling thread has printed. Output printed apart (by another thread,
+// then copied in) starts again from 0 and is counted in afterwards: a json array
+// joining two parts needs a "," in between, as the first record has none.
+size_t print_records(void);
+void print_set_records(size_t n);
 
 #endif
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>     // For isatty, STDERR_FILENO (POSIX)
+#include "gtree.h"
+#include "print.h"
+#include "progress.h"
+#include "timing.h"
+
+void progress_init(Progress *pg, int interval_ms, bool sizes) {
+    uint64_t now = timing_now();
+    *pg = (Progress){0};
+    pg->interval_ns = (uint64_t)interval_ms * 1000000u;
+    pg->next_ns = now + pg->interval_ns;
+    pg->last_ns = now;
+    pg->sizes = sizes;
+    pg->tty = isatty(STDERR_FILENO);
+}
+
+void progress_print(Progress *pg, const ActivityReport *report, const DirFrame *frame, uint64_t now) {
+    size_t entries = report->TOTAL_directories + report->TOTAL_file_count;
+    double rate = (double)(entries - pg->last_entries) * 1e9 / (double)(now - pg->last_ns);
+
+    char size[32] = "";
+    if (pg->sizes) {
+        char hsize[24];
+        human_size(report->TOTAL_file_size, hsize, sizeof(hsize));
+        snprintf(size, sizeof(size), ", %s", hsize);
+    }
+    fprintf(stderr, "%s%zu directories, %zu files%s, %.0f entries/s, depth %d: %s%s",
+            pg->tty ? "\r" : "", report->TOTAL_directories, report->TOTAL_file_count, size, rate,
+            frame->depth, frame->path, pg->tty ? "\033[K" : "\n");
+    pg->shown = pg->tty;
+
+    pg->last_ns = now;
+    pg->last_entries = entries;
+    pg->next_ns = now + pg->interval_ns;
+}
+
+void progress_done(Progress *pg) {
+    if (pg->shown) fputs("\r\033[K", stderr);
+    pg->shown = false;
+}
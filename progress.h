@@ -0,0 +1,35 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gtree.h"
+
+// -------------------- Progress line (--progress) --------------------
+// Every interval the walk's running totals, the rate entries (directories + files)
+// were reached at since the previous line, and where the walk is, go to stderr: one
+// line rewritten in place on a terminal, else one line each time. The walk only
+// counts, as it always does; progress_check() is called once per directory and
+// formats nothing until the interval has passed.
+
+typedef struct Progress {
+    uint64_t interval_ns;       // 0: off
+    uint64_t next_ns;           // Time the next line is due
+    uint64_t last_ns;           // Time of the previous line
+    size_t last_entries;        // Its directories + files
+    bool sizes;                 // File sizes are collected (-s/-f/--du): show the total
+    bool tty;                   // stderr is a terminal
+    bool shown;                 // A line is standing on the terminal
+} Progress;
+
+void progress_init(Progress *pg, int interval_ms, bool sizes);
+void progress_print(Progress *pg, const ActivityReport *report, const DirFrame *frame, uint64_t now);
+// Clears the line left on a terminal
+void progress_done(Progress *pg);
+
+static inline void progress_check(Progress *pg, const ActivityReport *report, const DirFrame *frame,
+                                  uint64_t now) {
+    if (now >= pg->next_ns) progress_print(pg, report, frame, now);
+}
+
+#endif
@@ -0,0 +1,537 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <dirent.h>     // For DIR, struct dirent, readdir (POSIX)
+#include <string.h>     // For strcmp, strlen, memcpy
+#include <sys/stat.h>   // For struct stat, S_ISDIR, S_ISLNK (POSIX)
+#include <unistd.h>     // For readlinkat (POSIX)
+#include <fcntl.h>      // For fstatat, AT_SYMLINK_NOFOLLOW (POSIX)
+#include <errno.h>      // For errno
+#include "gtree.h"
+#include "option_parsing.h"
+#include "arena.h"
+#include "scan.h"
+#include "timing.h"
+#ifdef GTREE_IO_URING
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/syscall.h> // For SYS_getdents64
+#include "memsafe.h"
+#include "uring.h"
+#endif
+
+// ----------------- d_type fast path -----------------
+// When neither -f nor -s is active we never need a file's size, so an entry whose
+// type the filesystem already reported in d_type can be classified without the
+// lstat()+stat() pair. Returns false when the caller must fall back to the stat
+// calls (DT_UNKNOWN, symlinks, or platforms without d_type).
+#ifdef DT_UNKNOWN
+#define DIRENT_TYPE(entry) ((entry)->d_type)
+#else
+#define DIRENT_TYPE(entry) 0
+#endif
+
+static bool classify_by_dtype(unsigned char d_type, bool *is_dir, bool *is_file) {
+#ifdef DT_UNKNOWN
+    switch (d_type) {
+        case DT_DIR: *is_dir = true;  *is_file = false; return true;
+        case DT_REG: *is_dir = false; *is_file = true;  return true;
+        case DT_LNK:
+        case DT_UNKNOWN: return false;
+        default: *is_dir = false; *is_file = false; return true; // fifo, socket, device: ignored
+    }
+#else
+    (void)d_type; (void)is_dir; (void)is_file;
+    return false;
+#endif
+}
+
+// ----------------- Build a path string -----------------
+// Joins a directory path and an entry name into a string allocated from arena.
+// Only needed once per directory (for printing); entries are accessed by fd + name.
+char *join_path(Arena *arena, const char *dir, const char *name) {
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    char *p = arena_alloc(arena, dlen + nlen + 2);
+    memcpy(p, dir, dlen);
+    p[dlen] = '/';
+    memcpy(p + dlen + 1, name, nlen + 1);
+    return p;
+}
+
+// ----------------- Symlink targets -----------------
+// Only read for links whose target will be shown: printed within -d (--du walks
+// deeper than it prints), or saved to a snapshot. --no-link-targets shows none.
+bool link_target_shown(const Options *opts, int depth) {
+    return !opts->no_link_targets && (depth <= opts->print_depth || opts->save_snapshot);
+}
+
+char *read_link_target(Arena *arena, int dfd, const char *name) {
+    char target[PATH_MAX];
+    uint64_t t = timing_start();
+    ssize_t len = readlinkat(dfd, name, target, PATH_MAX - 1);
+    timing_record(TIME_READLINK, t);
+    if (len == -1) len = 0; // readlink failed
+    return arena_strndup(arena, target, (size_t)len); // readlink does not null-terminate
+}
+
+// ----------------- Add a subdirectory node -----------------
+// Appends a new SubDirNode to the frame's subdirectory array (in the frame's arena)
+// st is the Phase 1 stat() of the entry (NULL if it was classified from d_type),
+// link_ino the inode of the symlink itself for a symlinked directory
+static void add_subdir(DirFrame *frame, bool is_symdir, ino_t link_ino, const char *name, const struct stat *st) {
+    Arena *arena = frame->arena;
+    if (frame->subdir_count == frame->subdir_cap)
+        frame->subdirs = arena_grow(arena, frame->subdirs, frame->subdir_count, &frame->subdir_cap,
+                                    sizeof(SubDirNode));
+
+    // Take the next slot and populate its name
+    SubDirNode *n = &frame->subdirs[frame->subdir_count++];
+    n->name = arena_strdup(arena, name);
+    n->is_symlink = is_symdir;
+
+    // Cache the identity so Phase 2 doesn't need to stat() the same path again
+    n->has_stat = (st != NULL);
+    n->dev = st ? st->st_dev : 0;
+    n->ino = st ? st->st_ino : 0;
+    n->mode = st ? st->st_mode : 0;
+    if (st) {
+        n->mtime = ST_MTIM(st);
+        n->ctime = ST_CTIM(st);
+        n->blocks = st->st_blocks;
+    }
+
+    // A symlink's target is read in Phase 2, when the link is reported
+    n->sym_path = is_symdir ? NULL : "";
+    n->link_ino = link_ino;
+
+    n->since = -1;
+    n->job = NULL;
+}
+
+// ----------------- File Handling -------------------
+// // Helper functions for maintaining a print_queue forfiles
+
+// want_target: read a symlink's target (see link_target_shown)
+static void add_subfile(Arena *arena, int dfd, const char *fname, bool is_symlink, bool want_target,
+                        bool dangling, const struct stat *st, DirFrame *frame){
+	if (frame->subfile_count == frame->subfile_cap)
+		frame->subfiles = arena_grow(arena, frame->subfiles, frame->subfile_count, &frame->subfile_cap,
+		                             sizeof(SubDirFile));
+	SubDirFile *n = &frame->subfiles[frame->subfile_count++];
+	n->name = arena_strdup(arena, fname);
+	n->target = NULL;
+	if (is_symlink && want_target)
+		n->target = read_link_target(arena, dfd, fname);
+	n->size = dangling ? 0 : st->st_size;
+	n->blocks = st->st_blocks;
+	n->dev = st->st_dev;
+	n->ino = st->st_ino;
+	n->mtime = ST_MTIM(st);
+	n->is_symlink = is_symlink;
+	n->dangling = dangling;
+	n->multi_link = !dangling && st->st_nlink > 1;
+}
+
+// -H: queue a file that other names may link to as well
+static void add_linked_file(Arena *arena, const struct stat *st, DirFrame *frame) {
+	if (frame->linked_count == frame->linked_cap)
+		frame->linked = arena_grow(arena, frame->linked, frame->linked_count, &frame->linked_cap,
+		                           sizeof(LinkedFile));
+	frame->linked[frame->linked_count++] = (LinkedFile){ st->st_dev, st->st_ino, st->st_size, st->st_blocks };
+}
+
+// ----------------- Handle Files -----------------
+// Handle files, symlinks, and dangling links properly.
+// fname is the entry name within the directory open on dfd. File entries queued
+// for printing (-f) or for --top are allocated from file_arena.
+static void HandleFiles(int dfd, const char *fname, DirFrame *frame, struct stat *st, struct stat *lst,
+                        ActivityReport *report, const Options *opts, Arena *file_arena) {
+
+    bool target_is_file = false;
+    bool target_is_dir = false;
+    bool dangling = false;
+    bool is_link;
+
+    // Determine target type if symlink
+    is_link = S_ISLNK(lst->st_mode);
+    if (is_link) {
+        if (st->st_mode == 0) {
+            dangling = true; // stat failed
+        } else if (S_ISDIR(st->st_mode)) {
+            target_is_dir = true;
+        } else if (S_ISREG(st->st_mode)) {
+            target_is_file = true;
+        }
+    }
+
+    // Case 1: regular file or symlink to file
+    if ((!is_link && S_ISREG(st->st_mode)) || target_is_file) {
+        frame->dir_file_count++;
+        frame->dir_file_size += st->st_size;
+        frame->dir_file_blocks += st->st_blocks;
+        report->TOTAL_file_count++;
+        report->TOTAL_file_size += st->st_size;
+        report->TOTAL_blocks += st->st_blocks;
+        if (is_link) report->TOTAL_linked_files++;
+        if (opts->dedup_links && st->st_nlink > 1)
+            add_linked_file(file_arena, st, frame);
+
+        // --top only needs the (non-link) files themselves
+        if (opts->show_files || (opts->top && !is_link))
+            add_subfile(file_arena, dfd, fname, is_link, is_link && link_target_shown(opts, frame->depth + 1),
+                        false, st, frame);
+        return;
+    }
+
+    // Case 2: dangling symlink (file or directory)
+    if (is_link && dangling) {
+        frame->dir_file_count++;
+        frame->dir_file_blocks += lst->st_blocks;
+        report->TOTAL_blocks += lst->st_blocks;
+        report->TOTAL_file_count++;
+        report->TOTAL_linked_files++;
+        if (opts->show_files)
+            add_subfile(file_arena, dfd, fname, true, link_target_shown(opts, frame->depth + 1), true, lst, frame);
+        return;
+    }
+
+    // Case 3: symlink to directory (or directory itself)
+    if (target_is_dir || (!is_link && S_ISDIR(st->st_mode))) {
+        // Don't count as a file; traversal will handle directories
+        return;
+    }
+
+    // Otherwise: ignore (non-regular, non-symlink files)
+}
+
+// ----------------- Per entry work -----------------
+// Sizes (-f/-s/--du/--top) and directory mtimes (--sort=mtime) aren't in d_type
+static bool scan_needs_stat(const Options *opts) {
+    return opts->show_files || opts->show_file_stats || opts->du || opts->top || opts->sort == SORT_MTIME;
+}
+
+// Skip hidden entries (unless -j) and always skip . and .. Decided from the name
+// (and d_type) alone, so a skipped entry never costs a stat() and a skipped
+// directory is never opened: --exclude applies to every entry, --include to
+// entries d_type reports as regular files (others are checked once stat()ed).
+static bool skip_entry(const char *name, unsigned char d_type, const Options *opts) {
+    if (!opts->show_hidden && name[0] == '.') return true;
+    if (!strcmp(name, ".") || !strcmp(name, "..")) return true;
+    if (filter_match(opts->exclude, name)) return true;
+#ifdef DT_REG
+    if (opts->include && d_type == DT_REG && !filter_match(opts->include, name)) return true;
+#else
+    (void)d_type;
+#endif
+    return false;
+}
+
+// Fast path: trust d_type when sizes aren't needed. Returns false if the entry must be stat()ed.
+static bool scan_entry_dtype(DirFrame *frame, const char *name, unsigned char d_type,
+                             bool need_stat, ActivityReport *report) {
+    bool dt_dir, dt_file;
+    if (need_stat || !classify_by_dtype(d_type, &dt_dir, &dt_file)) return false;
+    report->TOTAL_stat_avoided += 2;
+    if (dt_file) {
+        frame->dir_file_count++;
+        report->TOTAL_file_count++;
+    } else if (dt_dir) {
+        add_subdir(frame, false, 0, name, NULL);
+    }
+    return true;
+}
+
+// A stat()ed entry: st follows symlinks (st_mode 0 if that failed), lst doesn't
+static void scan_entry_stat(DirFrame *frame, int dfd, const char *name, struct stat *st, struct stat *lst,
+                            const Options *opts, ActivityReport *report, Arena *file_arena) {
+    bool is_symdir = S_ISLNK(lst->st_mode) && S_ISDIR(st->st_mode);
+
+    // --include only lets the files it matches through
+    if (opts->include && !S_ISDIR(st->st_mode) && !filter_match(opts->include, name))
+        return;
+
+    // Handle files (update stats, print if needed)
+    HandleFiles(dfd, name, frame, st, lst, report, opts, file_arena);
+
+    // Add subdirectory to list (regardless of if visited - this is checked in phase 2)
+    if (S_ISDIR(st->st_mode) || is_symdir)
+        add_subdir(frame, is_symdir, is_symdir ? lst->st_ino : 0, name, st);
+}
+
+// --timeout: true (and the frame marked) once the directory's deadline has passed
+static bool past_deadline(DirFrame *frame, uint64_t now, uint64_t deadline) {
+    if (!deadline || now <= deadline) return false;
+    frame->timed_out = true;
+    return true;
+}
+
+#ifdef GTREE_IO_URING
+// ----------------- getdents64 + io_uring backend -----------------
+// Entries are read GETDENTS_BUFFER bytes at a time. The lstat()s a batch needs are
+// issued together through io_uring, then the stat()s of the symlinks among them,
+// and the batch is processed in directory order; so results match readdir() exactly.
+#define GETDENTS_BUFFER (64 * 1024)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct BatchEntry {
+    const char *name;           // Points into the getdents buffer
+    unsigned char d_type;
+    bool fast;                  // Handled from d_type, no stat needed
+    struct stat st, lst;
+    int lst_err, st_err;
+} BatchEntry;
+
+// Per thread scratch space, reused from one directory to the next
+typedef struct ScanBatch {
+    _Alignas(8) char buf[GETDENTS_BUFFER];
+    BatchEntry *entries;
+    UringStat *reqs;
+    size_t cap;
+} ScanBatch;
+
+static __thread ScanBatch *thread_batch = NULL;
+static pthread_key_t batch_key;
+static pthread_once_t batch_key_once = PTHREAD_ONCE_INIT;
+
+static void batch_free(void *p) {
+    ScanBatch *b = p;
+    free(b->entries);
+    free(b->reqs);
+    free(b);
+}
+
+static void batch_key_create(void) {
+    pthread_key_create(&batch_key, batch_free);     // freed when the thread exits
+}
+
+// Returns the time the batch finished (0 if nothing is timed)
+static uint64_t stat_batch(int dfd, UringStat *reqs, size_t n, unsigned want, TimedCall call) {
+    uint64_t t = timing_start();
+    if (!uring_stat_batch(dfd, reqs, n, want)) {
+        for (size_t i = 0; i < n; i++)   // no io_uring here: one at a time
+            reqs[i].err = fstatat(dfd, reqs[i].name, reqs[i].st,
+                                  reqs[i].follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 ? 0 : errno;
+    }
+    return timing_record_batch(call, t, n);
+}
+
+// Returns false if getdents64 can't be used on dfd (nothing has been read then).
+// Stops between batches once the deadline (if any) has passed.
+static bool scan_directory_batched(DirFrame *frame, int dfd, const Options *opts,
+                                   ActivityReport *report, Arena *file_arena, uint64_t deadline) {
+    if (!thread_batch) {
+        pthread_once(&batch_key_once, batch_key_create);
+        thread_batch = xcalloc(1, sizeof(ScanBatch));
+        pthread_setspecific(batch_key, thread_batch);
+    }
+    ScanBatch *b = thread_batch;
+    bool need_stat = scan_needs_stat(opts);
+    unsigned want = (opts->show_files || opts->show_file_stats || opts->du || opts->top ? URING_WANT_SIZE : 0)
+                  | (opts->save_snapshot || opts->since || opts->sort == SORT_MTIME ? URING_WANT_TIMES : 0)
+                  | (opts->dedup_links || opts->save_snapshot ? URING_WANT_NLINK : 0);
+    bool first = true;
+
+    for (;;) {
+        uint64_t t = timing_start();
+        long nread = syscall(SYS_getdents64, dfd, b->buf, sizeof(b->buf));
+        int err = errno;
+        t = timing_record(TIME_READDIR, t);
+        if (nread < 0 && first) return false;
+        if (nread < 0) frame->read_err = err;   // not the end: the listing is cut short
+        if (nread <= 0 || past_deadline(frame, t, deadline)) return true;
+        first = false;
+
+        // Collect the batch, then queue an lstat() for every entry d_type can't settle
+        size_t n = 0, nreq = 0;
+        for (long pos = 0; pos < nread; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(b->buf + pos);
+            pos += d->d_reclen;
+            if (skip_entry(d->d_name, d->d_type, opts)) continue;
+            if (n == b->cap) {
+                b->cap = b->cap ? b->cap * 2 : 1024;
+                b->entries = xrealloc(b->entries, b->cap * sizeof(BatchEntry));
+                b->reqs = xrealloc(b->reqs, b->cap * sizeof(UringStat));
+            }
+            BatchEntry *e = &b->entries[n++];
+            e->name = d->d_name;
+            e->d_type = d->d_type;
+            bool dt_dir, dt_file;
+            e->fast = !need_stat && classify_by_dtype(d->d_type, &dt_dir, &dt_file);
+        }
+        for (size_t i = 0; i < n; i++) {
+            BatchEntry *e = &b->entries[i];
+            if (!e->fast)
+                b->reqs[nreq++] = (UringStat){ .name = e->name, .follow = false, .st = &e->lst };
+        }
+        t = stat_batch(dfd, b->reqs, nreq, want, TIME_LSTAT);
+        if (past_deadline(frame, t, deadline)) return true;
+        for (size_t i = 0, r = 0; i < n; i++)
+            if (!b->entries[i].fast) b->entries[i].lst_err = b->reqs[r++].err;
+
+        // Then the following stat() of the symlinks
+        nreq = 0;
+        for (size_t i = 0; i < n; i++) {
+            BatchEntry *e = &b->entries[i];
+            if (!e->fast && !e->lst_err && S_ISLNK(e->lst.st_mode))
+                b->reqs[nreq++] = (UringStat){ .name = e->name, .follow = true, .st = &e->st };
+        }
+        t = stat_batch(dfd, b->reqs, nreq, want, TIME_STAT);
+        if (past_deadline(frame, t, deadline)) return true;
+        for (size_t i = 0, r = 0; i < n; i++) {
+            BatchEntry *e = &b->entries[i];
+            if (!e->fast && !e->lst_err && S_ISLNK(e->lst.st_mode)) e->st_err = b->reqs[r++].err;
+        }
+
+        // Process in directory order
+        for (size_t i = 0; i < n; i++) {
+            BatchEntry *e = &b->entries[i];
+            if (e->fast) {
+                scan_entry_dtype(frame, e->name, e->d_type, false, report);
+                continue;
+            }
+            if (e->lst_err) continue;
+            if (!S_ISLNK(e->lst.st_mode)) e->st = e->lst;
+            else if (e->st_err) e->st.st_mode = 0;
+            scan_entry_stat(frame, dfd, e->name, &e->st, &e->lst, opts, report, file_arena);
+        }
+    }
+}
+#endif
+
+// ----------------- Scan one directory -----------------
+static void clear_listing(DirFrame *frame) {
+    frame->subdirs = NULL;
+    frame->subdir_count = frame->subdir_cap = 0;
+    frame->current = 0;
+    frame->subfiles = NULL;
+    frame->subfile_count = frame->subfile_cap = 0;
+    frame->linked = NULL;
+    frame->linked_count = frame->linked_cap = 0;
+    frame->dir_file_count = 0;
+    frame->dir_file_size = 0;
+    frame->dir_file_blocks = 0;
+}
+
+void scan_directory(DirFrame *frame, DIR *dir, const Options *opts,
+                    ActivityReport *report, Arena *file_arena) {
+    struct dirent *entry;
+    struct stat st, lst;
+    int dfd = dir ? dirfd(dir) : -1;
+
+    clear_listing(frame);
+    frame->timed_out = false;
+    frame->read_err = 0;
+    bool need_stat = scan_needs_stat(opts);
+
+    // --timeout counts the time already spent opening the directory (frame->scan_ns)
+    uint64_t start = timing_start();
+    uint64_t deadline = 0;
+    ActivityReport before = {0};
+    if (opts->timeout_ns && start) {
+        deadline = start + (frame->scan_ns < opts->timeout_ns ? opts->timeout_ns - frame->scan_ns : 0);
+        before = *report;
+    }
+
+#ifdef GTREE_IO_URING
+    // The stream hasn't been read yet, so its fd can be read directly instead
+    if (dir && scan_directory_batched(frame, dfd, opts, report, file_arena, deadline))
+        dir = NULL;
+#endif
+
+    // Read each entry in the directory
+    while (dir) {
+        uint64_t t = timing_start();
+        errno = 0;
+        entry = readdir(dir);
+        int err = errno;
+        t = timing_record(TIME_READDIR, t);
+        if (!entry && err) frame->read_err = err;   // not the end: the listing is cut short
+        if (!entry || past_deadline(frame, t, deadline)) break;
+
+        if (skip_entry(entry->d_name, DIRENT_TYPE(entry), opts))
+            continue;
+
+        if (scan_entry_dtype(frame, entry->d_name, DIRENT_TYPE(entry), need_stat, report))
+            continue;
+
+        // Stat relative to the directory fd; only symlinks need the second, following, call
+        t = timing_start();
+        int rc = fstatat(dfd, entry->d_name, &lst, AT_SYMLINK_NOFOLLOW);
+        timing_record(TIME_LSTAT, t);
+        if (rc == -1) continue;
+        if (!S_ISLNK(lst.st_mode)) st = lst;
+        else {
+            t = timing_start();
+            if (fstatat(dfd, entry->d_name, &st, 0) == -1) st.st_mode = 0;
+            timing_record(TIME_STAT, t);
+        }
+
+        scan_entry_stat(frame, dfd, entry->d_name, &st, &lst, opts, report, file_arena);
+    }
+
+    if (start) frame->scan_ns += timing_now() - start;
+
+    // Past the deadline: the directory is listed as [timeout], with nothing in it
+    if (frame->timed_out) {
+        clear_listing(frame);
+        *report = before;
+        report->TOTAL_timeouts++;
+        return;
+    }
+
+    sort_frame(frame, opts);
+}
+
+// ----------------- Entry order (--sort) -----------------
+// Plain byte comparison of names, so the order doesn't depend on the locale.
+// Ties on size/mtime fall back to the name, making every order total.
+static int cmp_timespec(struct timespec a, struct timespec b) {
+    if (a.tv_sec != b.tv_sec) return a.tv_sec < b.tv_sec ? -1 : 1;
+    if (a.tv_nsec != b.tv_nsec) return a.tv_nsec < b.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+static int cmp_subdir_name(const void *a, const void *b) {
+    return strcmp(((const SubDirNode *)a)->name, ((const SubDirNode *)b)->name);
+}
+
+static int cmp_subdir_mtime(const void *a, const void *b) {  // newest first
+    int c = cmp_timespec(((const SubDirNode *)b)->mtime, ((const SubDirNode *)a)->mtime);
+    return c ? c : cmp_subdir_name(a, b);
+}
+
+// Files are printed last to first, so these sort into reverse display order
+static int cmp_file_name(const void *a, const void *b) {
+    return strcmp(((const SubDirFile *)b)->name, ((const SubDirFile *)a)->name);
+}
+
+static int cmp_file_size(const void *a, const void *b) {    // largest first
+    off_t sa = ((const SubDirFile *)a)->size, sb = ((const SubDirFile *)b)->size;
+    if (sa != sb) return sa < sb ? -1 : 1;
+    return cmp_file_name(a, b);
+}
+
+static int cmp_file_mtime(const void *a, const void *b) {   // newest first
+    int c = cmp_timespec(((const SubDirFile *)a)->mtime, ((const SubDirFile *)b)->mtime);
+    return c ? c : cmp_file_name(a, b);
+}
+
+void sort_frame(DirFrame *frame, const Options *opts) {
+    if (opts->sort == SORT_NONE) return;
+
+    // Directories have no size of their own: --sort=size orders them by name
+    if (frame->subdir_count > 1)
+        qsort(frame->subdirs, frame->subdir_count, sizeof(SubDirNode),
+              opts->sort == SORT_MTIME ? cmp_subdir_mtime : cmp_subdir_name);
+    if (frame->subfile_count > 1)
+        qsort(frame->subfiles, frame->subfile_count, sizeof(SubDirFile),
+              opts->sort == SORT_SIZE ? cmp_file_size :
+              opts->sort == SORT_MTIME ? cmp_file_mtime : cmp_file_name);
+}
@@ -0,0 +1,28 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdbool.h>
+#include <dirent.h>     // For DIR
+#include "gtree.h"
+#include "option_parsing.h"
+
+// -------------------- Phase 1: directory scan --------------------
+// Reads every entry of an open directory stream into frame: the SubDirNode array
+// (allocated from frame->arena), the per-directory file count/size and, for -f,
+// the SubDirFile print queue (allocated from file_arena), ordered by sort_frame().
+// Totals go to report.
+// Touches nothing but its arguments, so scan workers can run it concurrently.
+void scan_directory(DirFrame *frame, DIR *dir, const Options *opts,
+                    ActivityReport *report, Arena *file_arena);
+
+// Puts the frame's subdirectories and files in --sort order (no-op for none)
+void sort_frame(DirFrame *frame, const Options *opts);
+
+char *join_path(Arena *arena, const char *dir, const char *name);
+
+// Whether a link target at depth is shown (and so worth a readlink())
+bool link_target_shown(const Options *opts, int depth);
+// The target of symlink name in directory dfd, "" if it can't be read
+char *read_link_target(Arena *arena, int dfd, const char *name);
+
+#endif
@@ -0,0 +1,405 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <dirent.h>     // For DIR, fdopendir, closedir (POSIX)
+#include <string.h>     // For memset
+#include <sys/stat.h>   // For struct stat, fstat, fstatat (POSIX)
+#include <unistd.h>     // For close (POSIX)
+#include <fcntl.h>      // For openat, fcntl, O_DIRECTORY (POSIX)
+#include <errno.h>      // For errno
+#include "gtree.h"
+#include "option_parsing.h"
+#include "memsafe.h"
+#include "arena.h"
+#include "visit_hash.h"
+#include "scan.h"
+#include "scan_pool.h"
+#include "timing.h"
+
+// ------------------- Work-stealing deque ------------------
+// Growable ring buffer. The owning worker pushes and pops at the bottom,
+// thieves take from the top. Each deque has its own lock.
+typedef struct JobDeque {
+    pthread_mutex_t lock;
+    ScanJob **jobs;
+    size_t cap;                 // Always a power of two
+    size_t top;                 // Index of the oldest job
+    size_t bottom;              // One past the newest job
+} JobDeque;
+
+typedef struct Worker {
+    struct ScanPool *pool;
+    pthread_t thread;
+    JobDeque deque;
+} Worker;
+
+struct ScanPool {
+    const Options *opts;
+    int nworkers;
+    Worker *workers;
+    pthread_mutex_t lock;       // Job states/refs and sleeping
+    pthread_cond_t work_cv;     // Signalled when a job is queued (or on shutdown)
+    pthread_cond_t done_cv;     // Broadcast when a job finishes
+    atomic_int queued;          // Jobs sitting in deques
+    atomic_int outstanding;     // Jobs in existence (bounded by SCAN_PREFETCH_LIMIT)
+    atomic_int fds_in_use;      // Directory fds held by scans in progress and parents
+    atomic_int fds_peak;
+    atomic_int parents;         // ScanParents held (bounded by opts->fd_budget)
+    atomic_uint next_worker;    // Round-robin target for jobs submitted by the main loop
+    bool one_device;            // -x: only scan ahead on root_dev
+    dev_t root_dev;
+    bool shutdown;
+};
+
+static void deque_init(JobDeque *d) {
+    pthread_mutex_init(&d->lock, NULL);
+    d->cap = 64;
+    d->jobs = xmalloc(d->cap * sizeof(ScanJob *));
+    d->top = d->bottom = 0;
+}
+
+static void deque_destroy(JobDeque *d) {
+    pthread_mutex_destroy(&d->lock);
+    free(d->jobs);
+}
+
+static void deque_push(JobDeque *d, ScanJob *job) {
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom - d->top == d->cap) {
+        ScanJob **grown = xmalloc(2 * d->cap * sizeof(ScanJob *));
+        for (size_t i = d->top; i < d->bottom; i++)
+            grown[i & (2 * d->cap - 1)] = d->jobs[i & (d->cap - 1)];
+        free(d->jobs);
+        d->jobs = grown;
+        d->cap *= 2;
+    }
+    d->jobs[d->bottom & (d->cap - 1)] = job;
+    d->bottom++;
+    pthread_mutex_unlock(&d->lock);
+}
+
+static ScanJob *deque_pop(JobDeque *d) {
+    ScanJob *job = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top)
+        job = d->jobs[--d->bottom & (d->cap - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+static ScanJob *deque_steal(JobDeque *d) {
+    ScanJob *job = NULL;
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom != d->top)
+        job = d->jobs[d->top++ & (d->cap - 1)];
+    pthread_mutex_unlock(&d->lock);
+    return job;
+}
+
+// ------------------- Parent directories ------------------
+// A directory whose subdirectories have been queued: a copy of its fd, closed once
+// the last of their jobs has opened its own directory or been dropped
+struct ScanParent {
+    int fd;
+    atomic_int refs;
+};
+
+static void fds_taken(ScanPool *pool) {
+    int in_use = atomic_fetch_add(&pool->fds_in_use, 1) + 1;
+    int peak = atomic_load(&pool->fds_peak);
+    while (in_use > peak && !atomic_compare_exchange_weak(&pool->fds_peak, &peak, in_use))
+        ;
+}
+
+// NULL if fd is -1, the copy can't be made or the pool already holds its share of fds
+static ScanParent *parent_create(ScanPool *pool, int fd) {
+    if (fd == -1 || atomic_load(&pool->parents) >= pool->opts->fd_budget) return NULL;
+    int copy = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (copy == -1) return NULL;
+    ScanParent *parent = xmalloc(sizeof(ScanParent));
+    parent->fd = copy;
+    atomic_init(&parent->refs, 1);
+    atomic_fetch_add(&pool->parents, 1);
+    fds_taken(pool);
+    return parent;
+}
+
+static void parent_unref(ScanPool *pool, ScanParent *parent) {
+    if (atomic_fetch_sub(&parent->refs, 1) != 1) return;
+    close(parent->fd);
+    free(parent);
+    atomic_fetch_sub(&pool->parents, 1);
+    atomic_fetch_sub(&pool->fds_in_use, 1);
+}
+
+// ------------------- Job lifetime ------------------
+static ScanJob *job_create(ScanPool *pool, ScanParent *parent, const char *name, int depth) {
+    ScanJob *job = xcalloc(1, sizeof(ScanJob));
+    atomic_fetch_add(&parent->refs, 1);
+    job->parent = parent;
+    job->name = arena_strdup(&job->arena, name);
+    job->depth = depth;
+    job->frame.arena = &job->arena;
+    job->state = JOB_QUEUED;
+    job->refs = 2; // owner + deque
+    atomic_fetch_add(&pool->outstanding, 1);
+    return job;
+}
+
+// Caller holds pool->lock
+static void job_unref_locked(ScanPool *pool, ScanJob *job) {
+    if (--job->refs > 0) return;
+    if (job->parent) parent_unref(pool, job->parent);
+    arena_free(&job->arena);
+    arena_free(&job->file_arena);
+    free(job);
+    atomic_fetch_sub(&pool->outstanding, 1);
+}
+
+// Caller holds pool->lock. Drops the owner reference of job and of every job
+// created from its result. A running job is left for its worker to drop.
+static void job_abandon_locked(ScanPool *pool, ScanJob *job) {
+    job->abandoned = true;
+    if (job->state == JOB_RUNNING) return;
+    if (job->state == JOB_DONE) {
+        for (size_t i = 0; i < job->frame.subdir_count; i++)
+            if (job->frame.subdirs[i].job) job_abandon_locked(pool, job->frame.subdirs[i].job);
+    }
+    job_unref_locked(pool, job);
+}
+
+// Counted before it is pushed, so a thief taking it at once never sees queued below 0
+static void submit(ScanPool *pool, Worker *w, ScanJob *job) {
+    atomic_fetch_add(&pool->queued, 1);
+    deque_push(&w->deque, job);
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_signal(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Subdirectories worth scanning ahead: ones the main loop can descend into
+static bool prefetchable(const ScanPool *pool, const SubDirNode *n, int child_depth) {
+    if (n->job || child_depth >= pool->opts->max_depth) return false;
+    if (n->is_symlink && !pool->opts->follow_links) return false;
+    // -x: opening a directory on another device is what must not happen, so only dev
+    // values cached by the Phase 1 stat() qualify
+    if (pool->one_device && (!n->has_stat || n->dev != pool->root_dev)) return false;
+    return atomic_load(&pool->outstanding) < SCAN_PREFETCH_LIMIT;
+}
+
+// ------------------- Running a scan ------------------
+// With keep, returns the directory as the parent of its subdirectories' jobs (NULL
+// if it has none, or none can be kept)
+static ScanParent *job_run(ScanPool *pool, ScanJob *job, bool keep) {
+    ScanParent *parent = job->parent;
+    ScanParent *kept = NULL;
+    uint64_t t = timing_start();
+    int fd = openat(parent->fd, job->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    uint64_t opened = timing_record(TIME_OPENDIR, t);
+    job->frame.scan_ns = opened - t;        // scan_directory() adds the reading time
+    if (fd == -1) {
+        job->err = errno;
+        job->stat_ok = (fstatat(parent->fd, job->name, &job->st, 0) == 0); // so Phase 2 can still report it
+    }
+    job->parent = NULL;
+    parent_unref(pool, parent);
+    if (fd == -1) return NULL;
+    fds_taken(pool);
+
+    t = timing_start();
+    job->stat_ok = (fstat(fd, &job->st) == 0);
+    timing_record(TIME_STAT, t);
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        job->err = errno;
+        close(fd);
+    } else {
+        scan_directory(&job->frame, dir, pool->opts, &job->report, &job->file_arena);
+        if (keep && job->frame.subdir_count) kept = parent_create(pool, dirfd(dir));
+        closedir(dir);
+    }
+    atomic_fetch_sub(&pool->fds_in_use, 1);
+    return kept;
+}
+
+// Queue the (non-symlinked) subdirectories found by a worker scan on that worker's
+// own deque, opened from parent. Pushed last-to-first so the first child is popped next.
+static void job_spawn_children(Worker *w, ScanJob *job, ScanParent *parent) {
+    ScanPool *pool = w->pool;
+    SubDirNode *kids[64];
+    size_t nkids = 0, i = 0;
+
+    while (i < job->frame.subdir_count) {
+        // Collect a batch in order, then submit it in reverse
+        nkids = 0;
+        for (; i < job->frame.subdir_count && nkids < 64; i++) {
+            SubDirNode *n = &job->frame.subdirs[i];
+            if (!n->is_symlink && prefetchable(pool, n, job->depth + 1))
+                kids[nkids++] = n;
+        }
+        while (nkids > 0) {
+            SubDirNode *k = kids[--nkids];
+            k->job = job_create(pool, parent, k->name, job->depth + 1);
+            submit(pool, w, k->job);
+        }
+    }
+    parent_unref(pool, parent);
+}
+
+static ScanJob *find_work(Worker *w) {
+    ScanJob *job = deque_pop(&w->deque);
+    for (int i = 1; !job && i < w->pool->nworkers; i++)
+        job = deque_steal(&w->pool->workers[(w - w->pool->workers + i) % w->pool->nworkers].deque);
+    if (job) atomic_fetch_sub(&w->pool->queued, 1);
+    return job;
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    ScanPool *pool = w->pool;
+
+    for (;;) {
+        ScanJob *job = find_work(w);
+        if (!job) {
+            pthread_mutex_lock(&pool->lock);
+            while (atomic_load(&pool->queued) == 0 && !pool->shutdown)
+                pthread_cond_wait(&pool->work_cv, &pool->lock);
+            bool done = pool->shutdown && atomic_load(&pool->queued) == 0;
+            pthread_mutex_unlock(&pool->lock);
+            if (done) return NULL;
+            continue;
+        }
+
+        // Claim the job unless the main loop already took it or gave up on it
+        pthread_mutex_lock(&pool->lock);
+        bool run = (job->state == JOB_QUEUED && !job->abandoned);
+        if (run) job->state = JOB_RUNNING;
+        job_unref_locked(pool, job); // the deque's reference
+        pthread_mutex_unlock(&pool->lock);
+        if (!run) continue;
+
+        ScanParent *parent = job_run(pool, job, true);
+        if (parent) job_spawn_children(w, job, parent);
+
+        pthread_mutex_lock(&pool->lock);
+        job->state = JOB_DONE;
+        if (job->abandoned) // given up on while running: drop it (and its children) now
+            job_abandon_locked(pool, job);
+        pthread_cond_broadcast(&pool->done_cv);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+// ------------------- Public interface (main loop only) ------------------
+// -x: keep scans ahead on the root's device (call before the first prefetch)
+void scan_pool_limit_device(ScanPool *pool, dev_t dev) {
+    pool->one_device = true;
+    pool->root_dev = dev;
+}
+
+ScanPool *scan_pool_create(int nthreads, const Options *opts) {
+    ScanPool *pool = xcalloc(1, sizeof(ScanPool));
+    pool->opts = opts;
+    pool->nworkers = nthreads;
+    pool->workers = xcalloc((size_t)nthreads, sizeof(Worker));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cv, NULL);
+    pthread_cond_init(&pool->done_cv, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        pool->workers[i].pool = pool;
+        deque_init(&pool->workers[i].deque);
+    }
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, worker_main, &pool->workers[i]) != 0) {
+            fprintf(stderr, "Fatal: could not start scan worker thread.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+// Stops the workers once every queued job has been drained. All jobs must have
+// been released or abandoned by then.
+void scan_pool_destroy(ScanPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work_cv);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nworkers; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+    for (int i = 0; i < pool->nworkers; i++)
+        deque_destroy(&pool->workers[i].deque);
+
+    pthread_cond_destroy(&pool->work_cv);
+    pthread_cond_destroy(&pool->done_cv);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
+
+// Queue scans for the subdirectories of a frame the main loop has just scanned or
+// adopted, skipping ones already in the walk's visited set (they won't be descended).
+// Without a set (--visited=ancestors) the rare loop costs one scan that is dropped.
+// They are opened from the frame's fd: a frame without one (adopted from a worker,
+// whose scan queued them already) is left to the main loop.
+void scan_pool_prefetch(ScanPool *pool, const DirFrame *frame, VisitedSet *visited) {
+    SubDirNode *kids[64];
+    size_t nkids, i = 0;
+    ScanParent *parent = NULL;
+
+    while (i < frame->subdir_count) {
+        nkids = 0;
+        for (; i < frame->subdir_count && nkids < 64; i++) {
+            SubDirNode *n = &frame->subdirs[i];
+            if (!prefetchable(pool, n, frame->depth + 1)) continue;
+            if (visited && n->has_stat && visited_before(visited, n->dev, n->ino)) continue;
+            kids[nkids++] = n;
+        }
+        if (nkids && !parent && !(parent = parent_create(pool, frame->fd))) return;
+        while (nkids > 0) {
+            SubDirNode *k = kids[--nkids];
+            k->job = job_create(pool, parent, k->name, frame->depth + 1);
+            unsigned w = atomic_fetch_add(&pool->next_worker, 1) % (unsigned)pool->nworkers;
+            submit(pool, &pool->workers[w], k->job);
+        }
+    }
+    if (parent) parent_unref(pool, parent);
+}
+
+// Wait for job's result. A job no worker has started yet is run here instead.
+void scan_pool_wait(ScanPool *pool, ScanJob *job) {
+    pthread_mutex_lock(&pool->lock);
+    if (job->state == JOB_QUEUED) {
+        job->state = JOB_RUNNING;
+        pthread_mutex_unlock(&pool->lock);
+        job_run(pool, job, false);
+        pthread_mutex_lock(&pool->lock);
+        job->state = JOB_DONE;
+    }
+    while (job->state != JOB_DONE)
+        pthread_cond_wait(&pool->done_cv, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Free a job whose result has been adopted (and whose subdirectories' jobs
+// have each been released or abandoned)
+void scan_pool_release(ScanPool *pool, ScanJob *job) {
+    pthread_mutex_lock(&pool->lock);
+    job_unref_locked(pool, job);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Give up on a job (and anything scheduled from it) that won't be adopted
+void scan_pool_abandon(ScanPool *pool, ScanJob *job) {
+    pthread_mutex_lock(&pool->lock);
+    job_abandon_locked(pool, job);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int scan_pool_peak_fds(ScanPool *pool) {
+    return atomic_load(&pool->fds_peak);
+}
@@ -0,0 +1,64 @@
+#ifndef SCAN_POOL_H
+#define SCAN_POOL_H
+
+#include <stdbool.h>
+#include <sys/stat.h>   // For struct stat
+#include "gtree.h"
+#include "option_parsing.h"
+#include "visit_hash.h"
+
+// -------------------- Parallel Phase 1 (-P N) --------------------
+// A pool of worker threads runs the Phase 1 scan of directories ahead of the main
+// loop. The main loop still walks the tree depth first, prints every line and owns
+// the visited set; when it reaches a directory that has a ScanJob it simply adopts
+// the finished result (waiting, or running the scan itself, if it isn't done yet).
+// Output is therefore identical to the serial walk.
+//
+// Each worker has its own deque of jobs. A worker pushes the subdirectories it finds
+// onto its own deque and pops from the same end (so it keeps going deeper, in the
+// order the main loop will want them) while idle workers steal from the other end.
+//
+// A job opens its directory with openat() from its parent's fd, as the main loop
+// does, so paths of any length work. The jobs queued from one listing share a copy
+// of the parent's fd. At most -F of these copies are held (besides the main loop's):
+// past that, subdirectories are left for the main loop to open itself.
+
+// Limit on jobs that exist at once (queued, running or finished but not yet popped
+// by the main loop). Bounds the memory held by results scanned ahead of printing.
+#define SCAN_PREFETCH_LIMIT 4096
+
+typedef enum { JOB_QUEUED, JOB_RUNNING, JOB_DONE } JobState;
+
+typedef struct ScanParent ScanParent;
+
+typedef struct ScanJob {
+    // Filled in when the job is created
+    ScanParent *parent;         // Directory it is opened from, until it has been (or is dropped)
+    char *name;                 // Its name in parent (in arena)
+    int depth;                  // Depth of the directory in the tree
+    // Results, valid once state == JOB_DONE
+    int err;                    // errno if the directory could not be opened, else 0
+    bool stat_ok;               // True if st below is valid
+    struct stat st;             // stat of the directory itself (its dev/ino for the visited set)
+    DirFrame frame;             // subdirs, subfiles, dir_file_count, dir_file_size
+    ActivityReport report;      // Totals for this directory, merged when the result is adopted
+    Arena arena;                // name, SubDirNode list
+    Arena file_arena;           // -f print queue
+    // Bookkeeping, protected by the pool lock
+    JobState state;
+    bool abandoned;             // Result no longer wanted
+    int refs;                   // Owner reference + one while sitting in a deque
+} ScanJob;
+
+typedef struct ScanPool ScanPool;
+
+ScanPool *scan_pool_create(int nthreads, const Options *opts);
+void scan_pool_destroy(ScanPool *pool);
+void scan_pool_limit_device(ScanPool *pool, dev_t dev);
+void scan_pool_prefetch(ScanPool *pool, const DirFrame *frame, VisitedSet *visited);
+void scan_pool_wait(ScanPool *pool, ScanJob *job);
+void scan_pool_release(ScanPool *pool, ScanJob *job);
+void scan_pool_abandon(ScanPool *pool, ScanJob *job);
+int scan_pool_peak_fds(ScanPool *pool);
+
+#endif
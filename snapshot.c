@@ -0,0 +1,755 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>     // For memcpy, memcmp, strlen
+#include <sys/stat.h>   // For struct stat, fstat (POSIX)
+#include <sys/mman.h>   // For mmap, munmap, posix_madvise (POSIX)
+#include <fcntl.h>      // For open (POSIX)
+#include <unistd.h>     // For close (POSIX)
+#include "gtree.h"
+#include "arena.h"
+#include "khashl.h"
+#include "memsafe.h"
+#include "option_parsing.h"
+#include "output.h"
+#include "print.h"
+#include "scan.h"
+#include "snapshot.h"
+
+#define SNAP_BYTE_ORDER 0x01020304u
+
+static int64_t timespec_ns(struct timespec t) {
+    return (int64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static struct timespec ns_timespec(int64_t ns) {
+    struct timespec t = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+    if (t.tv_nsec < 0) { t.tv_sec--; t.tv_nsec += 1000000000; }
+    return t;
+}
+
+// Element width of each column (the string table is bytes)
+static const size_t col_width[SNAP_COLUMNS] = {
+    sizeof(int64_t), sizeof(uint64_t), sizeof(uint64_t), sizeof(int64_t), sizeof(int64_t),
+    sizeof(int64_t), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+    sizeof(uint16_t), sizeof(uint8_t), sizeof(uint8_t), 1
+};
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+// ----------------- Writer -----------------
+// Columns grow in memory during the walk and are written out in one go at the end.
+struct SnapshotWriter {
+    char *file;                         // Destination (written via file.tmp + rename), NULL if kept in memory
+    uint32_t hdr_flags;
+    size_t count, cap;                  // Entries used / allocated in every column
+    int64_t *size;
+    uint64_t *dev, *ino;
+    int64_t *mtime, *ctime, *blocks;
+    uint32_t *name, *target, *next;
+    uint16_t *depth;
+    uint8_t *type, *flags;
+    char *strings;                      // String table
+    size_t strings_size, strings_cap;
+    bool overflow;                      // String table or entry count exceeded 32 bits
+    uint32_t last_dir[MAX_DEPTH + 2];   // Latest directory entry per depth, to link next[]
+};
+
+SnapshotWriter *snapshot_create(const char *file, bool follow_links) {
+    SnapshotWriter *w = xcalloc(1, sizeof(SnapshotWriter));
+    if (file) {
+        w->file = xmalloc(strlen(file) + 1);
+        strcpy(w->file, file);
+    }
+    w->hdr_flags = follow_links ? SNAP_HDR_FOLLOW_LINKS : 0;
+    for (int i = 0; i < MAX_DEPTH + 2; i++)
+        w->last_dir[i] = SNAPSHOT_NONE;
+    return w;
+}
+
+static uint32_t add_string(SnapshotWriter *w, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (w->strings_size + len > SNAPSHOT_NONE) {
+        w->overflow = true;
+        return SNAPSHOT_NONE;
+    }
+    if (w->strings_size + len > w->strings_cap) {
+        size_t cap = w->strings_cap ? w->strings_cap : 64 * 1024;
+        while (cap < w->strings_size + len) cap *= 2;
+        w->strings = xrealloc(w->strings, cap);
+        w->strings_cap = cap;
+    }
+    memcpy(w->strings + w->strings_size, s, len);
+    uint32_t off = (uint32_t)w->strings_size;
+    w->strings_size += len;
+    return off;
+}
+
+static uint32_t add_entry(SnapshotWriter *w, const char *name, const char *target, int depth,
+                          uint8_t type, uint8_t flags, off_t size, blkcnt_t blocks, dev_t dev,
+                          ino_t ino, int64_t mtime, int64_t ctime) {
+    if (w->count == SNAPSHOT_NONE) {
+        w->overflow = true;
+        return SNAPSHOT_NONE;
+    }
+    if (w->count == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 4096;
+        w->size = xrealloc(w->size, cap * sizeof(*w->size));
+        w->dev = xrealloc(w->dev, cap * sizeof(*w->dev));
+        w->ino = xrealloc(w->ino, cap * sizeof(*w->ino));
+        w->mtime = xrealloc(w->mtime, cap * sizeof(*w->mtime));
+        w->ctime = xrealloc(w->ctime, cap * sizeof(*w->ctime));
+        w->blocks = xrealloc(w->blocks, cap * sizeof(*w->blocks));
+        w->name = xrealloc(w->name, cap * sizeof(*w->name));
+        w->target = xrealloc(w->target, cap * sizeof(*w->target));
+        w->next = xrealloc(w->next, cap * sizeof(*w->next));
+        w->depth = xrealloc(w->depth, cap * sizeof(*w->depth));
+        w->type = xrealloc(w->type, cap * sizeof(*w->type));
+        w->flags = xrealloc(w->flags, cap * sizeof(*w->flags));
+        w->cap = cap;
+    }
+    size_t i = w->count++;
+    w->size[i] = (int64_t)size;
+    w->dev[i] = (uint64_t)dev;
+    w->ino[i] = (uint64_t)ino;
+    w->mtime[i] = mtime;
+    w->ctime[i] = ctime;
+    w->blocks[i] = (int64_t)blocks;
+    w->name[i] = add_string(w, name);
+    w->target[i] = target ? add_string(w, target) : SNAPSHOT_NONE;
+    w->next[i] = SNAPSHOT_NONE;
+    w->depth[i] = (uint16_t)depth;
+    w->type[i] = type;
+    w->flags[i] = flags;
+    return (uint32_t)i;
+}
+
+// Link directory entry i to the previous subdirectory of the same parent; a new
+// directory starts a fresh list one level down
+static void link_dir(SnapshotWriter *w, uint32_t i, int depth) {
+    if (i == SNAPSHOT_NONE) return;
+    if (depth > 0 && w->last_dir[depth] != SNAPSHOT_NONE)
+        w->next[w->last_dir[depth]] = i;
+    w->last_dir[depth] = i;
+    w->last_dir[depth + 1] = SNAPSHOT_NONE;
+}
+
+void snapshot_add_dir(SnapshotWriter *w, const char *name, int depth, bool is_symlink,
+                      const char *target, const struct stat *st, bool descended, bool recursive) {
+    uint8_t flags = (descended ? SNAP_DESCENDED : 0) | (recursive ? SNAP_RECURSIVE : 0);
+    uint32_t i = add_entry(w, name, is_symlink ? target : NULL, depth,
+                           is_symlink ? SNAP_DIRLINK : SNAP_DIR, flags, 0, st ? st->st_blocks : 0,
+                           st ? st->st_dev : 0, st ? st->st_ino : 0,
+                           st ? timespec_ns(ST_MTIM(st)) : 0, st ? timespec_ns(ST_CTIM(st)) : 0);
+    link_dir(w, i, depth);
+}
+
+void snapshot_add_files(SnapshotWriter *w, const DirFrame *frame) {
+    for (size_t i = frame->subfile_count; i-- > 0;) {
+        const SubDirFile *f = &frame->subfiles[i];
+        uint8_t type = f->dangling ? SNAP_DANGLING : f->is_symlink ? SNAP_FILELINK : SNAP_FILE;
+        add_entry(w, f->name, f->target, frame->depth + 1, type, f->multi_link ? SNAP_MULTILINK : 0,
+                  f->size, f->blocks, f->dev, f->ino, timespec_ns(f->mtime), 0);
+    }
+}
+
+static void free_writer(SnapshotWriter *w) {
+    free(w->size); free(w->dev); free(w->ino); free(w->mtime); free(w->ctime); free(w->blocks);
+    free(w->name); free(w->target); free(w->next);
+    free(w->depth); free(w->type); free(w->flags);
+    free(w->strings);
+    free(w->file);
+    free(w);
+}
+
+void snapshot_discard(SnapshotWriter *w) {
+    free_writer(w);
+}
+
+long snapshot_finish(SnapshotWriter *w) {
+    if (w->overflow) {
+        fprintf(stderr, "Snapshot too large for the %s format\n", w->file);
+        free_writer(w);
+        return -1;
+    }
+
+    SnapshotHeader hdr = {0};
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.byte_order = SNAP_BYTE_ORDER;
+    hdr.flags = w->hdr_flags;
+    hdr.count = w->count;
+    hdr.strings_size = w->strings_size;
+
+    const void *col_data[SNAP_COLUMNS] = {
+        w->size, w->dev, w->ino, w->mtime, w->ctime, w->blocks, w->name, w->target, w->next,
+        w->depth, w->type, w->flags, w->strings
+    };
+    size_t off = align8(sizeof(hdr));
+    for (int c = 0; c < SNAP_COLUMNS; c++) {
+        hdr.col[c] = off;
+        off = align8(off + (c == SNAP_COL_STRINGS ? w->strings_size : w->count * col_width[c]));
+    }
+
+    // Write next to the destination and rename over it, so readers never see a partial file
+    size_t tlen = strlen(w->file) + 5;
+    char *tmp = xmalloc(tlen);
+    snprintf(tmp, tlen, "%s.tmp", w->file);
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror(tmp);
+        free(tmp);
+        free_writer(w);
+        return -1;
+    }
+
+    static const char pad[8] = {0};
+    size_t pos = 0;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    pos += sizeof(hdr);
+    for (int c = 0; ok && c < SNAP_COLUMNS; c++) {
+        size_t len = c == SNAP_COL_STRINGS ? w->strings_size : w->count * col_width[c];
+        ok = fwrite(pad, 1, hdr.col[c] - pos, fp) == hdr.col[c] - pos
+          && (len == 0 || fwrite(col_data[c], 1, len, fp) == len);
+        pos = hdr.col[c] + len;
+    }
+    if (fclose(fp) != 0) ok = false;
+    if (ok && rename(tmp, w->file) != 0) ok = false;
+    if (!ok) {
+        perror(w->file);
+        unlink(tmp);
+    }
+
+    long count = ok ? (long)w->count : -1;
+    free(tmp);
+    free_writer(w);
+    return count;
+}
+
+// ----------------- Reader -----------------
+// Directory entries with a listing, by dev/ino (built on first use by --since)
+typedef struct { uint64_t dev, ino; } SnapKey;
+
+static inline khint_t snap_key_hash(SnapKey k) {
+    return kh_hash_uint64((k.dev * 11400714819323198485ULL) ^ k.ino);
+}
+static inline int snap_key_equal(SnapKey a, SnapKey b) {
+    return a.dev == b.dev && a.ino == b.ino;
+}
+KHASHL_MAP_INIT(static kh_inline klib_unused, snap_index, snap_index, SnapKey, uint32_t, snap_key_hash, snap_key_equal)
+KHASHL_SET_INIT(static kh_inline klib_unused, snap_set, snap_set, SnapKey, snap_key_hash, snap_key_equal)
+
+// Column pointers straight into the mapping; nothing is parsed or copied.
+struct Snapshot {
+    void *map;
+    SnapshotWriter *writer;     // Columns still held by the walk's writer (snapshot_take), else NULL
+    size_t map_size;
+    size_t count;
+    const int64_t *size;
+    const uint64_t *dev, *ino;
+    const int64_t *mtime, *ctime, *blocks;
+    const uint32_t *name, *target, *next;
+    const uint16_t *depth;
+    const uint8_t *type, *flags;
+    const char *strings;
+    size_t strings_size;
+    snap_index *index;
+    bool trusted;               // snapshot_trust(): subtrees nothing changed in are copied whole
+    snap_set *stale;            // Directories invalidated or to recheck since (trusted only)
+    uint8_t *changed;           // Per entry: a stale directory is in its subtree (built on first use)
+};
+
+Snapshot *snapshot_load(const char *file, bool follow_links) {
+    int fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(file);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror(file);
+        close(fd);
+        return NULL;
+    }
+    Snapshot *s = xcalloc(1, sizeof(Snapshot));
+    s->map_size = (size_t)st.st_size;
+    s->map = s->map_size >= sizeof(SnapshotHeader)
+           ? mmap(NULL, s->map_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (s->map == MAP_FAILED) {
+        fprintf(stderr, "%s: not a gtree snapshot\n", file);
+        free(s);
+        return NULL;
+    }
+    posix_madvise(s->map, s->map_size, POSIX_MADV_SEQUENTIAL);
+
+    // Check the header and that every column lies inside the file
+    const SnapshotHeader *hdr = s->map;
+    const char *base = s->map;
+    bool ok = !memcmp(hdr->magic, SNAPSHOT_MAGIC, sizeof(hdr->magic))
+           && hdr->version == SNAPSHOT_VERSION
+           && hdr->byte_order == SNAP_BYTE_ORDER
+           && hdr->count < SNAPSHOT_NONE;
+    for (int c = 0; ok && c < SNAP_COLUMNS; c++) {
+        uint64_t len = c == SNAP_COL_STRINGS ? hdr->strings_size : hdr->count * col_width[c];
+        ok = hdr->col[c] % 8 == 0 && hdr->col[c] <= s->map_size && len <= s->map_size - hdr->col[c];
+    }
+    if (ok) {
+        s->count = hdr->count;
+        s->size = (const void *)(base + hdr->col[SNAP_COL_SIZE]);
+        s->dev = (const void *)(base + hdr->col[SNAP_COL_DEV]);
+        s->ino = (const void *)(base + hdr->col[SNAP_COL_INO]);
+        s->mtime = (const void *)(base + hdr->col[SNAP_COL_MTIME]);
+        s->ctime = (const void *)(base + hdr->col[SNAP_COL_CTIME]);
+        s->blocks = (const void *)(base + hdr->col[SNAP_COL_BLOCKS]);
+        s->name = (const void *)(base + hdr->col[SNAP_COL_NAME]);
+        s->target = (const void *)(base + hdr->col[SNAP_COL_TARGET]);
+        s->next = (const void *)(base + hdr->col[SNAP_COL_NEXT]);
+        s->depth = (const void *)(base + hdr->col[SNAP_COL_DEPTH]);
+        s->type = (const void *)(base + hdr->col[SNAP_COL_TYPE]);
+        s->flags = (const void *)(base + hdr->col[SNAP_COL_FLAGS]);
+        s->strings = base + hdr->col[SNAP_COL_STRINGS];
+        s->strings_size = hdr->strings_size;
+        ok = s->count > 0 && s->strings_size > 0 && s->strings[s->strings_size - 1] == '\0'
+          && s->depth[0] == 0 && s->type[0] == SNAP_DIR;
+    }
+    if (!ok) {
+        fprintf(stderr, "%s: not a gtree snapshot (or written by another version)\n", file);
+        munmap(s->map, s->map_size);
+        free(s);
+        return NULL;
+    }
+    // Which directory links were followed was decided when it was saved
+    if (!(hdr->flags & SNAP_HDR_FOLLOW_LINKS) != !follow_links) {
+        fprintf(stderr, "%s: saved %s -l, so it can only be used %s -l\n", file,
+                follow_links ? "without" : "with", follow_links ? "without" : "with");
+        munmap(s->map, s->map_size);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void snapshot_unload(Snapshot *s) {
+    if (s->index) snap_index_destroy(s->index);
+    if (s->stale) snap_set_destroy(s->stale);
+    free(s->changed);
+    if (s->writer) free_writer(s->writer);
+    else munmap(s->map, s->map_size);
+    free(s);
+}
+
+Snapshot *snapshot_take(SnapshotWriter *w) {
+    if (w->overflow || w->count == 0) {
+        fprintf(stderr, "Tree too large to keep as a snapshot\n");
+        free_writer(w);
+        return NULL;
+    }
+    Snapshot *s = xcalloc(1, sizeof(Snapshot));
+    s->writer = w;
+    s->count = w->count;
+    s->size = w->size;
+    s->dev = w->dev;
+    s->ino = w->ino;
+    s->mtime = w->mtime;
+    s->ctime = w->ctime;
+    s->blocks = w->blocks;
+    s->name = w->name;
+    s->target = w->target;
+    s->next = w->next;
+    s->depth = w->depth;
+    s->type = w->type;
+    s->flags = w->flags;
+    s->strings = w->strings;
+    s->strings_size = w->strings_size;
+    return s;
+}
+
+static const char *snap_str(const Snapshot *s, uint32_t off) {
+    return off < s->strings_size ? s->strings + off : "";
+}
+
+// Entries the walk would have skipped: hidden ones and those --exclude/--include filter out
+static bool snap_hidden(const Snapshot *s, size_t i, const Options *opts) {
+    const char *name = snap_str(s, s->name[i]);
+    if (!opts->show_hidden && name[0] == '.') return true;
+    if (filter_match(opts->exclude, name)) return true;
+    return opts->include && s->type[i] >= SNAP_FILE && !filter_match(opts->include, name);
+}
+
+// True if no shown subdirectory follows entry i in its directory
+static bool snap_is_last(const Snapshot *s, size_t i, const Options *opts) {
+    for (uint32_t j = s->next[i]; j != SNAPSHOT_NONE && j > i && j < s->count; i = j, j = s->next[j])
+        if (!snap_hidden(s, j, opts)) return false;
+    return true;
+}
+
+// Paths are rebuilt in one buffer: the entry at depth d owns bytes [0, len[d])
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t len[MAX_DEPTH + 2];
+} PathBuf;
+
+static char *path_set(PathBuf *pb, int depth, const char *name) {
+    size_t start = depth > 0 ? pb->len[depth - 1] + 1 : 0;
+    size_t nlen = strlen(name);
+    if (start + nlen + 1 > pb->cap) {
+        pb->cap = (start + nlen + 1) * 2;
+        pb->buf = xrealloc(pb->buf, pb->cap);
+    }
+    if (depth > 0) pb->buf[start - 1] = '/';
+    memcpy(pb->buf + start, name, nlen + 1);
+    pb->len[depth] = start + nlen;
+    return pb->buf;
+}
+
+// --du: the subtrees of the directories being listed at depth and below are complete.
+// Innermost first, each one's own files join its totals, which go to its parent, and
+// its line is printed, as the walk does when it pops a frame.
+static void du_finish(DirFrame *frames, PathBuf *pb, int open_depth, int depth, Options *opts) {
+    for (int d = open_depth; d >= depth; d--) {
+        DirFrame *frame = &frames[d];
+        frame->tree_file_count += frame->dir_file_count;
+        frame->tree_file_size += frame->dir_file_size;
+        frame->tree_blocks += frame->dir_file_blocks;
+        if (d > 0) {
+            frames[d - 1].tree_file_count += frame->tree_file_count;
+            frames[d - 1].tree_file_size += frame->tree_file_size;
+            frames[d - 1].tree_blocks += frame->tree_blocks;
+        }
+        pb->buf[pb->len[d]] = '\0';
+        frame->path = pb->buf;
+        print_du_line(frame, opts);
+    }
+}
+
+bool snapshot_print(const Snapshot *sp, Options *opts, ActivityReport *report) {
+    const Snapshot s = *sp;
+
+    static bool ancestor_siblings[MAX_DEPTH + 2];
+    static DirFrame frames[MAX_DEPTH + 2];
+    PathBuf pb = {0};
+    int open_depth = -1;    // Depth of the innermost directory being listed
+    int skip_depth = -1;    // Entries below this depth are not shown
+    bool ok = true;
+
+    for (size_t i = 0; i < s.count; i++) {
+        int depth = s.depth[i];
+        if (skip_depth >= 0) {
+            if (depth > skip_depth) continue;
+            skip_depth = -1;
+        }
+        if (s.type[i] >= SNAP_FILE) continue;   // listed with their directory
+        if (depth > open_depth + 1 || depth > MAX_DEPTH || (depth == 0 && i > 0)) {
+            ok = false;
+            break;
+        }
+        if (opts->du) du_finish(frames, &pb, open_depth, depth, opts);
+        open_depth = depth - 1;
+        if (depth > 0 && snap_hidden(&s, i, opts)) {
+            skip_depth = depth;
+            continue;
+        }
+
+        // Same decisions as Phase 2 of the live walk
+        bool is_last = false;
+        if (depth > 0) {
+            DirFrame temp = {0};
+            temp.path = path_set(&pb, depth, snap_str(&s, s.name[i]));
+            temp.depth = depth;
+            temp.ancestor_siblings = ancestor_siblings;
+
+            is_last = snap_is_last(&s, i, opts);
+            if (depth < opts->max_depth)
+                set_ancestor_sibling(&frames[depth - 1], depth, !is_last);
+
+            bool recursive = s.flags[i] & SNAP_RECURSIVE;
+            bool descend = (s.flags[i] & SNAP_DESCENDED) && depth < opts->max_depth;
+            if (s.type[i] == SNAP_DIRLINK) {
+                // --du prints a followed link after its subtree, with the totals
+                descend = descend && opts->follow_links;
+                if (!opts->du || !descend)
+                    print_entry_line(&temp, is_last, true,
+                                     s.target[i] == SNAPSHOT_NONE ? NULL : snap_str(&s, s.target[i]),
+                                     recursive, NULL, true, opts);
+                report->TOTAL_linked_directories++;
+                if (!descend && !recursive && depth >= opts->max_depth)
+                    track_max_depth(report, depth);
+            } else if (!descend) {
+                print_entry_line(&temp, is_last, false, NULL, recursive, NULL, true, opts);
+                if (!recursive) report->TOTAL_directories++;
+                track_max_depth(report, depth);
+            }
+            if (!descend) {
+                skip_depth = depth;
+                continue;
+            }
+            report->TOTAL_directories++;
+            track_max_depth(report, depth);
+        }
+
+        // Same as Phase 1: the directory line, then its files
+        DirFrame *frame = &frames[depth];
+        *frame = (DirFrame){0};
+        frame->path = path_set(&pb, depth, snap_str(&s, s.name[i]));
+        frame->depth = depth;
+        frame->is_last = is_last;
+        frame->ancestor_siblings = ancestor_siblings;
+        frame->is_symlink = s.type[i] == SNAP_DIRLINK;
+        if (frame->is_symlink && s.target[i] != SNAPSHOT_NONE) frame->sym_path = snap_str(&s, s.target[i]);
+        if (opts->du) {
+            frame->tree_blocks = s.blocks[i];
+            report->TOTAL_blocks += s.blocks[i];
+        }
+        open_depth = depth;
+
+        size_t last_file = i + 1;
+        for (; last_file < s.count && s.depth[last_file] == depth + 1 && s.type[last_file] >= SNAP_FILE;
+             last_file++) {
+            if (snap_hidden(&s, last_file, opts)) continue;
+            uint8_t type = s.type[last_file];
+            frame->dir_file_count++;
+            report->TOTAL_file_count++;
+            if (type != SNAP_FILE) report->TOTAL_linked_files++;
+            if (type != SNAP_DANGLING) {
+                frame->dir_file_size += s.size[last_file];
+                report->TOTAL_file_size += s.size[last_file];
+            }
+            frame->dir_file_blocks += s.blocks[last_file];
+            report->TOTAL_blocks += s.blocks[last_file];
+        }
+
+        if (!opts->du)
+            print_entry_line(frame, frame->is_last, false, NULL, false, NULL, true, opts);
+        if (opts->show_files) {
+            for (size_t j = i + 1; j < last_file; j++) {
+                if (snap_hidden(&s, j, opts)) continue;
+                SubDirFile f = {0};
+                f.name = (char *)snap_str(&s, s.name[j]);
+                f.target = s.target[j] == SNAPSHOT_NONE ? NULL : (char *)snap_str(&s, s.target[j]);
+                f.size = s.size[j];
+                f.is_symlink = s.type[j] != SNAP_FILE;
+                f.dangling = s.type[j] == SNAP_DANGLING;
+                print_file_line(frame, &f, opts);
+            }
+        }
+        out_dir_done();
+    }
+    if (ok && opts->du) du_finish(frames, &pb, open_depth, 0, opts);
+
+    free(pb.buf);
+    return ok;
+}
+
+bool snapshot_render(const char *file, Options *opts, ActivityReport *report) {
+    Snapshot *s = snapshot_load(file, opts->follow_links);
+    if (!s) return false;
+    bool ok = snapshot_print(s, opts, report);
+    if (!ok)
+        fprintf(stderr, "%s: snapshot is corrupt\n", file);
+    snapshot_unload(s);
+    return ok;
+}
+
+void snapshot_each_dir(const Snapshot *s, void (*fn)(void *ctx, const char *path, dev_t dev, ino_t ino),
+                       void *ctx) {
+    PathBuf pb = {0};
+    for (size_t i = 0; i < s->count; i++) {
+        if (s->type[i] >= SNAP_FILE || s->depth[i] > MAX_DEPTH) continue;
+        const char *path = path_set(&pb, s->depth[i], snap_str(s, s->name[i]));
+        if (s->flags[i] & SNAP_DESCENDED)
+            fn(ctx, path, (dev_t)s->dev[i], (ino_t)s->ino[i]);
+    }
+    free(pb.buf);
+}
+
+// ----------------- Incremental walk (--since) -----------------
+static void snap_index_build(Snapshot *s) {
+    if (s->index) return;
+    s->index = snap_index_init();
+    for (size_t i = 0; i < s->count; i++) {
+        if (s->type[i] >= SNAP_FILE || !(s->flags[i] & SNAP_DESCENDED)) continue;
+        int absent;
+        khint_t k = snap_index_put(s->index, (SnapKey){ s->dev[i], s->ino[i] }, &absent);
+        kh_val(s->index, k) = (uint32_t)i;
+    }
+}
+
+size_t snapshot_dir_count(Snapshot *s) {
+    snap_index_build(s);
+    return kh_size(s->index);
+}
+
+long snapshot_match(Snapshot *s, const struct stat *st) {
+    snap_index_build(s);
+    khint_t k = snap_index_get(s->index, (SnapKey){ (uint64_t)st->st_dev, (uint64_t)st->st_ino });
+    if (k == kh_end(s->index)) return -1;
+    uint32_t i = kh_val(s->index, k);
+    if (s->mtime[i] != timespec_ns(ST_MTIM(st)) || s->ctime[i] != timespec_ns(ST_CTIM(st))) return -1;
+    return (long)i;
+}
+
+// A directory whose subtree the next walk can't take whole, listing kept or not
+static void mark_stale(Snapshot *s, dev_t dev, ino_t ino) {
+    if (!s->stale) s->stale = snap_set_init();
+    int absent;
+    snap_set_put(s->stale, (SnapKey){ (uint64_t)dev, (uint64_t)ino }, &absent);
+}
+
+void snapshot_invalidate(Snapshot *s, dev_t dev, ino_t ino) {
+    snap_index_build(s);
+    khint_t k = snap_index_get(s->index, (SnapKey){ (uint64_t)dev, (uint64_t)ino });
+    if (k != kh_end(s->index)) snap_index_del(s->index, k);
+    mark_stale(s, dev, ino);
+}
+
+void snapshot_recheck(Snapshot *s, dev_t dev, ino_t ino) {
+    mark_stale(s, dev, ino);
+}
+
+void snapshot_trust(Snapshot *s) {
+    s->trusted = true;
+}
+
+// changed[i]: directory entry i, or a directory listed below it, is stale. Entries are
+// in pre-order, so the latest directory at each depth encloses the ones that follow.
+static void mark_changed(Snapshot *s) {
+    s->changed = xcalloc(s->count, 1);
+    if (!s->stale) return;
+    uint32_t open[MAX_DEPTH + 2];
+    for (size_t i = 0; i < s->count; i++) {
+        int depth = s->depth[i];
+        if (s->type[i] >= SNAP_FILE || depth > MAX_DEPTH) continue;
+        open[depth] = (uint32_t)i;
+        if (!(s->flags[i] & SNAP_DESCENDED)
+            || snap_set_get(s->stale, (SnapKey){ s->dev[i], s->ino[i] }) == kh_end(s->stale))
+            continue;
+        for (int d = depth; d >= 0 && !s->changed[open[d]]; d--)
+            s->changed[open[d]] = 1;
+    }
+}
+
+size_t snapshot_copy_subtree(Snapshot *s, long entry, SnapshotWriter *w, int depth,
+                             bool (*seen)(void *ctx, dev_t dev, ino_t ino),
+                             void (*note)(void *ctx, dev_t dev, ino_t ino), void *ctx) {
+    size_t i = (size_t)entry;
+    if (!s->trusted || s->type[i] != SNAP_DIR || !(s->flags[i] & SNAP_DESCENDED) || s->depth[i] != depth)
+        return 0;
+    if (!s->changed) mark_changed(s);
+    if (s->changed[i]) return 0;
+
+    // Unchanged, but the walk would still decide differently if what made an entry
+    // [recursive] is gone, or a directory has been reached some other way by now
+    size_t end = i;
+    for (; end < s->count && (end == i || s->depth[end] > depth); end++) {
+        if (s->type[end] >= SNAP_FILE) continue;
+        uint8_t flags = s->flags[end];
+        if ((flags & SNAP_RECURSIVE) || (s->type[end] == SNAP_DIRLINK && (flags & SNAP_DESCENDED)))
+            return 0;
+        if (s->ino[end] && seen(ctx, (dev_t)s->dev[end], (ino_t)s->ino[end]))
+            return 0;
+    }
+
+    size_t listings = 0;
+    for (size_t j = i; j < end; j++) {
+        uint8_t type = s->type[j];
+        uint32_t k = add_entry(w, snap_str(s, s->name[j]),
+                               s->target[j] == SNAPSHOT_NONE ? NULL : snap_str(s, s->target[j]),
+                               s->depth[j], type, s->flags[j], s->size[j], s->blocks[j],
+                               (dev_t)s->dev[j], (ino_t)s->ino[j], s->mtime[j], s->ctime[j]);
+        if (type >= SNAP_FILE) continue;
+        link_dir(w, k, s->depth[j]);
+        if (type == SNAP_DIR) note(ctx, (dev_t)s->dev[j], (ino_t)s->ino[j]);
+        if (s->flags[j] & SNAP_DESCENDED) listings++;
+    }
+    return listings;
+}
+
+void snapshot_reuse(const Snapshot *s, long entry, DirFrame *frame, const Options *opts,
+                    ActivityReport *report, Arena *file_arena) {
+    size_t i = (size_t)entry;
+    int depth = s->depth[i] + 1;
+
+    frame->subdirs = NULL;
+    frame->subdir_count = frame->subdir_cap = 0;
+    frame->subfiles = NULL;
+    frame->subfile_count = frame->subfile_cap = 0;
+    frame->linked = NULL;
+    frame->linked_count = frame->linked_cap = 0;
+    frame->dir_file_count = 0;
+    frame->dir_file_size = 0;
+    frame->dir_file_blocks = 0;
+
+    // Files: counted as HandleFiles() does. The print queue is built backwards
+    // because it is printed from the most recently added entry.
+    size_t first = i + 1, end = first;
+    while (end < s->count && s->depth[end] == depth && s->type[end] >= SNAP_FILE) end++;
+    for (size_t j = end; j-- > first; ) {
+        if (snap_hidden(s, j, opts)) continue;
+        uint8_t type = s->type[j];
+        frame->dir_file_count++;
+        report->TOTAL_file_count++;
+        if (type != SNAP_FILE) report->TOTAL_linked_files++;
+        if (type != SNAP_DANGLING) {
+            frame->dir_file_size += s->size[j];
+            report->TOTAL_file_size += s->size[j];
+        }
+        frame->dir_file_blocks += s->blocks[j];
+        report->TOTAL_blocks += s->blocks[j];
+        if (opts->dedup_links && (s->flags[j] & SNAP_MULTILINK)) {
+            if (frame->linked_count == frame->linked_cap)
+                frame->linked = arena_grow(file_arena, frame->linked, frame->linked_count,
+                                           &frame->linked_cap, sizeof(LinkedFile));
+            frame->linked[frame->linked_count++] = (LinkedFile){
+                (dev_t)s->dev[j], (ino_t)s->ino[j], s->size[j], s->blocks[j] };
+        }
+        if (opts->show_files || (opts->top && type == SNAP_FILE)) {
+            if (frame->subfile_count == frame->subfile_cap)
+                frame->subfiles = arena_grow(file_arena, frame->subfiles, frame->subfile_count,
+                                             &frame->subfile_cap, sizeof(SubDirFile));
+            SubDirFile *f = &frame->subfiles[frame->subfile_count++];
+            f->name = (char *)snap_str(s, s->name[j]);
+            f->target = s->target[j] == SNAPSHOT_NONE ? NULL : (char *)snap_str(s, s->target[j]);
+            // Saved with --no-link-targets: read the ones this run shows
+            if (type != SNAP_FILE && !f->target && frame->fd != -1
+                && link_target_shown(opts, frame->depth + 1))
+                f->target = read_link_target(file_arena, frame->fd, f->name);
+            f->size = s->size[j];
+            f->blocks = s->blocks[j];
+            f->dev = (dev_t)s->dev[j];
+            f->ino = (ino_t)s->ino[j];
+            f->mtime = ns_timespec(s->mtime[j]);
+            f->is_symlink = type != SNAP_FILE;
+            f->dangling = type == SNAP_DANGLING;
+            f->multi_link = s->flags[j] & SNAP_MULTILINK;
+        }
+    }
+
+    // Subdirectories, in their original order. Phase 2 stat()s each of them, so
+    // their own listings are checked in turn.
+    uint32_t j = end < s->count && s->depth[end] == depth ? (uint32_t)end : SNAPSHOT_NONE;
+    for (; j != SNAPSHOT_NONE && j < s->count; j = s->next[j] > j ? s->next[j] : SNAPSHOT_NONE) {
+        if (snap_hidden(s, j, opts)) continue;
+        if (frame->subdir_count == frame->subdir_cap)
+            frame->subdirs = arena_grow(frame->arena, frame->subdirs, frame->subdir_count,
+                                        &frame->subdir_cap, sizeof(SubDirNode));
+        SubDirNode *n = &frame->subdirs[frame->subdir_count++];
+        n->name = (char *)snap_str(s, s->name[j]);
+        n->is_symlink = s->type[j] == SNAP_DIRLINK;
+        n->sym_path = !n->is_symlink ? "" : s->target[j] == SNAPSHOT_NONE ? NULL
+                                          : (char *)snap_str(s, s->target[j]);
+        n->link_ino = 0;
+        n->has_stat = false;
+        n->mtime = ns_timespec(s->mtime[j]);
+        n->ctime = ns_timespec(s->ctime[j]);
+        n->blocks = s->blocks[j];
+        n->since = (long)j;
+        n->job = NULL;
+    }
+    frame->current = 0;
+
+    // Stored in the order they were saved in; re-sort for this run's --sort
+    sort_frame(frame, opts);
+}
@@ -0,0 +1,141 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include "gtree.h"
+#include "option_parsing.h"
+
+// -------------------- Snapshot file format --------------------
+// A snapshot is the walk in print order (pre-order), one entry per printed line,
+// stored column by column so a reader can mmap it and index straight into it:
+//
+//   SnapshotHeader | size[] dev[] ino[] mtime[] ctime[] blocks[] | name[] target[] next[] | depth[] |
+//   type[] flags[] | strings
+//
+// Names and link targets are offsets into a string table of NUL terminated
+// strings. A directory's files follow it directly, then its subdirectories, each
+// subdirectory entry linking to the next one in the same directory (next[]).
+// Directories also keep their mtime/ctime, so --since can tell whether the
+// listing is still valid; files keep their mtime for --sort=mtime. Integers are in the byte order of the writing machine.
+#define SNAPSHOT_MAGIC   "GTSNAP\0\0"
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_NONE    UINT32_MAX   // no string / no next sibling
+
+// Entry types
+enum {
+    SNAP_DIR = 0,           // directory
+    SNAP_DIRLINK,           // symlink to a directory
+    SNAP_FILE,              // regular file
+    SNAP_FILELINK,          // symlink to a regular file
+    SNAP_DANGLING           // symlink whose target could not be stat()ed
+};
+
+// Entry flags
+#define SNAP_DESCENDED  0x01    // directory contents follow this entry
+#define SNAP_RECURSIVE  0x02    // already visited when reached ([recursive])
+#define SNAP_MULTILINK  0x04    // file with more than one hard link (for -H)
+
+// Header flags
+#define SNAP_HDR_FOLLOW_LINKS 0x01  // saved with -l
+
+// Columns, in file order
+enum {
+    SNAP_COL_SIZE = 0,      // int64_t
+    SNAP_COL_DEV,           // uint64_t
+    SNAP_COL_INO,           // uint64_t
+    SNAP_COL_MTIME,         // int64_t nanoseconds
+    SNAP_COL_CTIME,         // int64_t nanoseconds (directories only)
+    SNAP_COL_BLOCKS,        // int64_t 512-byte blocks allocated
+    SNAP_COL_NAME,          // uint32_t string offset
+    SNAP_COL_TARGET,        // uint32_t string offset or SNAPSHOT_NONE
+    SNAP_COL_NEXT,          // uint32_t entry index or SNAPSHOT_NONE
+    SNAP_COL_DEPTH,         // uint16_t
+    SNAP_COL_TYPE,          // uint8_t
+    SNAP_COL_FLAGS,         // uint8_t
+    SNAP_COL_STRINGS,       // string table
+    SNAP_COLUMNS
+};
+
+typedef struct {
+    char magic[8];              // SNAPSHOT_MAGIC
+    uint32_t version;           // SNAPSHOT_VERSION
+    uint32_t byte_order;        // 0x01020304 in the writer's byte order
+    uint32_t flags;             // SNAP_HDR_*
+    uint32_t reserved;
+    uint64_t count;             // number of entries
+    uint64_t strings_size;      // bytes in the string table
+    uint64_t col[SNAP_COLUMNS]; // file offset of each column (8 byte aligned)
+} SnapshotHeader;
+
+// -------------------- Writer (--save-snapshot) --------------------
+typedef struct SnapshotWriter SnapshotWriter;
+
+// file NULL: the snapshot is only kept in memory, see snapshot_take()
+SnapshotWriter *snapshot_create(const char *file, bool follow_links);
+// Directory line: descended means its own scan follows (files, then subdirectories)
+void snapshot_add_dir(SnapshotWriter *w, const char *name, int depth, bool is_symlink,
+                      const char *target, const struct stat *st, bool descended, bool recursive);
+// File lines of frame, in print order (straight after its snapshot_add_dir)
+void snapshot_add_files(SnapshotWriter *w, const DirFrame *frame);
+// Writes the file and frees the writer; returns the entry count, or -1 on error
+long snapshot_finish(SnapshotWriter *w);
+// Frees the writer without writing anything (a walk stopped early)
+void snapshot_discard(SnapshotWriter *w);
+
+// -------------------- Reader (--load-snapshot, --since) --------------------
+typedef struct Snapshot Snapshot;
+
+// Maps and validates file; returns NULL (after reporting why) if it isn't usable,
+// also if it was saved with -l and follow_links is false or the other way round
+Snapshot *snapshot_load(const char *file, bool follow_links);
+void snapshot_unload(Snapshot *s);
+
+// Turns the writer into a snapshot in memory instead of writing it out (--watch);
+// returns NULL if it is too large for the format. Frees the writer either way.
+Snapshot *snapshot_take(SnapshotWriter *w);
+
+// Renders a snapshot through print.c as if the tree had been walked with opts
+// (-d, -f, -s, -j, -C, -c, -o, --du, and -l as saved), filling report. Returns false on error.
+// --du totals are added up from the entries on the way.
+bool snapshot_render(const char *file, Options *opts, ActivityReport *report);
+// The same for a loaded or kept snapshot; false if it is corrupt
+bool snapshot_print(const Snapshot *s, Options *opts, ActivityReport *report);
+// Calls fn with the path, dev and ino of every directory whose listing s holds, in walk order
+void snapshot_each_dir(const Snapshot *s, void (*fn)(void *ctx, const char *path, dev_t dev, ino_t ino),
+                       void *ctx);
+
+// --since: the snapshot entry holding the listing of the directory st describes,
+// or -1 if it has no listing or the directory's mtime/ctime moved since
+long snapshot_match(Snapshot *s, const struct stat *st);
+// Number of directories s holds a listing of
+size_t snapshot_dir_count(Snapshot *s);
+// Forget the listing of directory dev/ino, so --since reads it again even though its
+// mtime/ctime didn't move (a file in it changed)
+void snapshot_invalidate(Snapshot *s, dev_t dev, ino_t ino);
+// Directory dev/ino may have changed without being reported (it was read before it was
+// watched): the next walk looks at it itself, reusing its listing only if its
+// mtime/ctime didn't move
+void snapshot_recheck(Snapshot *s, dev_t dev, ino_t ino);
+// Every change to the directories s holds listings of is reported through
+// snapshot_invalidate() or snapshot_recheck() (--watch's inotify), both called
+// before the next walk: that walk can take subtrees nothing changed in from s whole
+void snapshot_trust(Snapshot *s);
+// For a trusted s: copies subdirectory entry, and everything below it, into w at depth
+// as the walk would record them if nothing in that subtree changed, without opening
+// anything. seen() tells whether the walk has reached a directory already; a subtree
+// with a [recursive] entry, a followed directory link (its target is watched, not the
+// path to it) or a directory seen() knows is left to the walk. The directories the walk
+// would have noted as reached are passed to note(). Returns the number of listings
+// copied, 0 if nothing was.
+size_t snapshot_copy_subtree(Snapshot *s, long entry, SnapshotWriter *w, int depth,
+                             bool (*seen)(void *ctx, dev_t dev, ino_t ino),
+                             void (*note)(void *ctx, dev_t dev, ino_t ino), void *ctx);
+// Phase 1 from the snapshot instead of readdir(): as scan_directory(), fills the
+// frame's subdirectories (each with its own entry in SubDirNode.since), file count/size
+// and (for -f) files from entry
+void snapshot_reuse(const Snapshot *s, long entry, DirFrame *frame, const Options *opts,
+                    ActivityReport *report, Arena *file_arena);
+
+#endif
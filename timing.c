@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>       // For clock_gettime, CLOCK_MONOTONIC (POSIX)
+#include "memsafe.h"
+#include "output.h"
+#include "top.h"
+#include "timing.h"
+
+// One table per thread that made a timed call
+typedef struct CallStats {
+    uint64_t calls[TIME_CALLS];
+    uint64_t total_ns[TIME_CALLS];
+    uint64_t worst_ns[TIME_CALLS];
+    uint64_t hist[TIME_CALLS][TIMING_BUCKETS];
+    struct CallStats *next;
+} CallStats;
+
+static bool timing_on = false;
+static __thread CallStats *thread_stats = NULL;
+static CallStats *all_stats = NULL;             // Every table, for timing_print()
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *call_names[TIME_CALLS] = { "opendir", "readdir", "lstat", "stat", "readlink" };
+
+void timing_enable(void) {
+    timing_on = true;
+}
+
+uint64_t timing_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t timing_start(void) {
+    return timing_on ? timing_now() : 0;
+}
+
+static CallStats *get_stats(void) {
+    if (!thread_stats) {
+        thread_stats = xcalloc(1, sizeof(CallStats));
+        pthread_mutex_lock(&stats_lock);
+        thread_stats->next = all_stats;
+        all_stats = thread_stats;
+        pthread_mutex_unlock(&stats_lock);
+    }
+    return thread_stats;
+}
+
+// Bucket 0 is below 1us, bucket b >= 1 is [2^(b-1)us, 2^b us)
+static int bucket_of(uint64_t ns) {
+    uint64_t us = ns / 1000;
+    int b = us ? 64 - __builtin_clzll(us) : 0;
+    return b < TIMING_BUCKETS ? b : TIMING_BUCKETS - 1;
+}
+
+uint64_t timing_record_batch(TimedCall c, uint64_t start, size_t n) {
+    if (!start) return 0;
+    uint64_t now = timing_now();
+    if (n == 0) return now;
+    uint64_t each = (now - start) / n;
+    CallStats *s = get_stats();
+    s->calls[c] += n;
+    s->total_ns[c] += now - start;
+    if (s->worst_ns[c] < each) s->worst_ns[c] = each;
+    s->hist[c][bucket_of(each)] += n;
+    return now;
+}
+
+uint64_t timing_record(TimedCall c, uint64_t start) {
+    return timing_record_batch(c, start, 1);
+}
+
+// ----------------- Report -----------------
+static void format_ns(uint64_t ns, char *out, size_t outsz) {
+    if (ns < 1000) snprintf(out, outsz, "%uns", (unsigned)ns);
+    else if (ns < 1000000) snprintf(out, outsz, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(out, outsz, "%.1fms", ns / 1e6);
+    else snprintf(out, outsz, "%.2fs", ns / 1e9);
+}
+
+// Histogram bucket bound, given in us
+static void format_bound(uint64_t us, char *out, size_t outsz) {
+    if (us < 1000) snprintf(out, outsz, "%uus", (unsigned)us);
+    else if (us < 1000000) snprintf(out, outsz, "%.3gms", us / 1e3);
+    else snprintf(out, outsz, "%.3gs", us / 1e6);
+}
+
+// Every thread's table added up
+static void sum_stats(CallStats *sum) {
+    *sum = (CallStats){0};
+    for (CallStats *s = all_stats; s; s = s->next) {
+        for (int c = 0; c < TIME_CALLS; c++) {
+            sum->calls[c] += s->calls[c];
+            sum->total_ns[c] += s->total_ns[c];
+            if (sum->worst_ns[c] < s->worst_ns[c]) sum->worst_ns[c] = s->worst_ns[c];
+            for (int b = 0; b < TIMING_BUCKETS; b++)
+                sum->hist[c][b] += s->hist[c][b];
+        }
+    }
+}
+
+void timing_print(TopList *slowest) {
+    CallStats sum;
+    sum_stats(&sum);
+
+    out_printf("\nTime in file system calls:\n  %-9s %10s %10s %10s %10s\n",
+               "call", "count", "total", "average", "worst");
+    for (int c = 0; c < TIME_CALLS; c++) {
+        if (!sum.calls[c]) continue;
+        char total[32], avg[32], worst[32];
+        format_ns(sum.total_ns[c], total, sizeof(total));
+        format_ns(sum.total_ns[c] / sum.calls[c], avg, sizeof(avg));
+        format_ns(sum.worst_ns[c], worst, sizeof(worst));
+        out_printf("  %-9s %10ju %10s %10s %10s\n", call_names[c], (uintmax_t)sum.calls[c],
+                   total, avg, worst);
+    }
+
+    // One row per duration bucket that any call fell into
+    out_printf("\nCalls by duration:\n  %-17s", "");
+    for (int c = 0; c < TIME_CALLS; c++)
+        out_printf(" %9s", call_names[c]);
+    out_puts("\n");
+    for (int b = 0; b < TIMING_BUCKETS; b++) {
+        bool used = false;
+        for (int c = 0; c < TIME_CALLS; c++)
+            used |= sum.hist[c][b] != 0;
+        if (!used) continue;
+        char lo[32], hi[32];
+        format_bound(b ? (uint64_t)1 << (b - 1) : 0, lo, sizeof(lo));
+        format_bound((uint64_t)1 << b, hi, sizeof(hi));
+        if (b == TIMING_BUCKETS - 1) out_printf("  >= %-14s", lo);
+        else out_printf("  %7s - %-7s", lo, hi);
+        for (int c = 0; c < TIME_CALLS; c++)
+            out_printf(" %9ju", (uintmax_t)sum.hist[c][b]);
+        out_puts("\n");
+    }
+
+    top_sort(slowest);
+    out_printf("\nSlowest directories (open and read):\n");
+    for (size_t i = 0; i < slowest->count; i++) {
+        char t[32];
+        format_ns((uint64_t)slowest->heap[i].size, t, sizeof(t));
+        out_printf("%8s  %s\n", t, slowest->heap[i].path);
+    }
+}
+
+void timing_write_json(FILE *f) {
+    CallStats sum;
+    sum_stats(&sum);
+    fputs("{", f);
+    for (int c = 0; c < TIME_CALLS; c++) {
+        fprintf(f, "%s\n    \"%s\": {\"count\": %ju, \"total_ns\": %ju, \"worst_ns\": %ju, \"histogram\": [",
+                c ? "," : "", call_names[c], (uintmax_t)sum.calls[c], (uintmax_t)sum.total_ns[c],
+                (uintmax_t)sum.worst_ns[c]);
+        for (int b = 0; b < TIMING_BUCKETS; b++)
+            fprintf(f, "%s%ju", b ? ", " : "", (uintmax_t)sum.hist[c][b]);
+        fputs("]}", f);
+    }
+    fputs("\n  }", f);
+}
+
+void timing_free(void) {
+    while (all_stats) {
+        CallStats *next = all_stats->next;
+        free(all_stats);
+        all_stats = next;
+    }
+    thread_stats = NULL;
+}
@@ -0,0 +1,42 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>      // For FILE
+#include "top.h"
+
+// -------------------- Slow path instrumentation (--timing, --timeout) --------------------
+// Wall time of the file system calls the walk makes, by kind of call: count, total,
+// worst, and a histogram in power-of-two buckets from 1us up. Each thread counts into
+// its own table, so the hot path takes no lock; the tables are summed for the summary.
+// Until timing_enable() is called timing_start() returns 0 and nothing is recorded.
+
+typedef enum {
+    TIME_OPENDIR,
+    TIME_READDIR,
+    TIME_LSTAT,
+    TIME_STAT,
+    TIME_READLINK,
+    TIME_CALLS
+} TimedCall;
+
+#define TIMING_BUCKETS 24       // [0, 1us), [1us, 2us), [2us, 4us) ... [2^22us (~4s), inf)
+
+void timing_enable(void);
+uint64_t timing_now(void);      // CLOCK_MONOTONIC in ns
+// Start time of a call, or 0 if timing is off
+uint64_t timing_start(void);
+// Records one call of kind c begun at start; returns the time it ended (0 if timing is off)
+uint64_t timing_record(TimedCall c, uint64_t start);
+// n calls made together (an io_uring batch) begun at start, each credited with the average
+uint64_t timing_record_batch(TimedCall c, uint64_t start, size_t n);
+// Prints the call table and histogram, then the slowest directories (sorted in place)
+void timing_print(TopList *slowest);
+// The same totals as a JSON object by call name: count, total_ns, worst_ns and the
+// histogram's TIMING_BUCKETS counts (--stats-json)
+void timing_write_json(FILE *f);
+void timing_free(void);
+
+#endif
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>     // For strlen, memcpy
+#include "gtree.h"
+#include "memsafe.h"
+#include "output.h"
+#include "print.h"
+#include "top.h"
+
+void top_init(TopList *t, size_t limit) {
+    t->limit = limit;
+    t->count = 0;
+    t->heap = limit ? xmalloc(limit * sizeof(TopEntry)) : NULL;
+}
+
+// ----------------- Heap helpers -----------------
+static void sift_down(TopList *t, size_t i) {
+    TopEntry *h = t->heap;
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < t->count && h[l].size < h[min].size) min = l;
+        if (r < t->count && h[r].size < h[min].size) min = r;
+        if (min == i) return;
+        TopEntry tmp = h[i]; h[i] = h[min]; h[min] = tmp;
+        i = min;
+    }
+}
+
+static void sift_up(TopList *t, size_t i) {
+    TopEntry *h = t->heap;
+    while (i > 0) {
+        size_t p = (i - 1) / 2;
+        if (h[p].size <= h[i].size) return;
+        TopEntry tmp = h[i]; h[i] = h[p]; h[p] = tmp;
+        i = p;
+    }
+}
+
+static char *make_path(const char *dir, const char *name) {
+    size_t dlen = strlen(dir), nlen = name ? strlen(name) : 0;
+    char *p = xmalloc(dlen + nlen + 2);
+    memcpy(p, dir, dlen);
+    if (name) {
+        p[dlen] = '/';
+        memcpy(p + dlen + 1, name, nlen);
+        dlen += nlen + 1;
+    }
+    p[dlen] = '\0';
+    return p;
+}
+
+// ----------------- Public interface -----------------
+void top_add(TopList *t, const char *dir, const char *name, off_t size) {
+    if (t->count < t->limit) {
+        t->heap[t->count] = (TopEntry){ make_path(dir, name), size };
+        sift_up(t, t->count++);
+        return;
+    }
+    // Full: only something larger than the smallest kept gets in (ties keep the first seen)
+    if (t->limit == 0 || size <= t->heap[0].size) return;
+    free(t->heap[0].path);
+    t->heap[0] = (TopEntry){ make_path(dir, name), size };
+    sift_down(t, 0);
+}
+
+static int cmp_top_desc(const void *a, const void *b) {
+    off_t sa = ((const TopEntry *)a)->size, sb = ((const TopEntry *)b)->size;
+    if (sa != sb) return sa < sb ? 1 : -1;
+    return strcmp(((const TopEntry *)a)->path, ((const TopEntry *)b)->path);
+}
+
+void top_sort(TopList *t) {
+    qsort(t->heap, t->count, sizeof(TopEntry), cmp_top_desc);
+}
+
+void top_print(TopList *t, const char *title) {
+    top_sort(t);
+    out_printf("\n%s:\n", title);
+    for (size_t i = 0; i < t->count; i++) {
+        char hsize[32];
+        human_size(t->heap[i].size, hsize, sizeof(hsize));
+        out_printf("%8s  %s\n", hsize, t->heap[i].path);
+    }
+}
+
+void top_free(TopList *t) {
+    for (size_t i = 0; i < t->count; i++)
+        free(t->heap[i].path);
+    free(t->heap);
+    t->heap = NULL;
+    t->count = 0;
+}
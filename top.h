@@ -0,0 +1,33 @@
+#ifndef TOP_H
+#define TOP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// -------------------- Largest entries (--top N) --------------------
+// Keeps the N largest entries seen so far in a min-heap, so memory stays O(N)
+// however big the tree is: a new entry only costs a path copy when it is larger
+// than the smallest one kept.
+
+typedef struct {
+    char *path;             // Full path (malloc'd, owned by the list)
+    off_t size;
+} TopEntry;
+
+typedef struct {
+    TopEntry *heap;         // Min-heap on size: heap[0] is the smallest kept
+    size_t count;           // Entries kept
+    size_t limit;           // N
+} TopList;
+
+void top_init(TopList *t, size_t limit);
+// Offers dir/name (name NULL: dir is the entry's path) of the given size
+void top_add(TopList *t, const char *dir, const char *name, off_t size);
+// Puts the entries in order, largest first (heap order is lost)
+void top_sort(TopList *t);
+// Prints the entries largest first under title; the list is left sorted
+void top_print(TopList *t, const char *title);
+void top_free(TopList *t);
+
+#endif
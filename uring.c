@@ -0,0 +1,199 @@
+#define _GNU_SOURCE             // For struct statx
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>             // For memset
+#include <errno.h>              // For errno, EINTR
+#include <fcntl.h>              // For fstatat, AT_SYMLINK_NOFOLLOW
+#include <unistd.h>             // For syscall, close
+#include <pthread.h>
+#include <sys/mman.h>           // For mmap, munmap
+#include <sys/stat.h>           // For struct stat, struct statx
+#include <sys/syscall.h>        // For __NR_io_uring_setup, __NR_io_uring_enter
+#include <sys/sysmacros.h>      // For makedev
+#include <linux/io_uring.h>
+#include "memsafe.h"
+#include "uring.h"
+
+// ------------------- Ring set up ------------------
+typedef struct Ring {
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_map, *cq_map;              // cq_map == sq_map with IORING_FEAT_SINGLE_MMAP
+    size_t sq_map_size, cq_map_size, sqes_size;
+    struct statx *bufs;                 // Per request results of the current batch
+    size_t bufs_cap;
+} Ring;
+
+static __thread Ring *thread_ring = NULL;
+static __thread bool ring_unavailable = false;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static void ring_destroy(void *p) {
+    Ring *r = p;
+    munmap(r->sqes, r->sqes_size);
+    if (r->cq_map != r->sq_map) munmap(r->cq_map, r->cq_map_size);
+    munmap(r->sq_map, r->sq_map_size);
+    close(r->fd);
+    free(r->bufs);
+    free(r);
+}
+
+static void ring_key_create(void) {
+    pthread_key_create(&ring_key, ring_destroy);    // rings go away with their thread
+}
+
+static Ring *ring_create(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_QUEUE_DEPTH, &p);
+    if (fd < 0) return NULL;
+
+    Ring *r = xcalloc(1, sizeof(Ring));
+    r->fd = fd;
+    r->sq_entries = p.sq_entries;
+    r->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_map_size > r->sq_map_size) r->sq_map_size = r->cq_map_size;
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_map = mmap(NULL, r->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_SQ_RING);
+    r->cq_map = single ? r->sq_map
+              : mmap(NULL, r->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, IORING_OFF_SQES);
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED || r->sqes == MAP_FAILED) {
+        if (r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_size);
+        if (!single && r->cq_map != MAP_FAILED) munmap(r->cq_map, r->cq_map_size);
+        if (r->sq_map != MAP_FAILED) munmap(r->sq_map, r->sq_map_size);
+        close(fd);
+        free(r);
+        return NULL;
+    }
+
+    char *sq = r->sq_map, *cq = r->cq_map;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return r;
+}
+
+static Ring *get_ring(void) {
+    if (thread_ring || ring_unavailable) return thread_ring;
+    pthread_once(&ring_key_once, ring_key_create);
+    thread_ring = ring_create();
+    if (thread_ring) pthread_setspecific(ring_key, thread_ring);
+    else ring_unavailable = true;
+    return thread_ring;
+}
+
+// ------------------- Stat batches ------------------
+// Only the fields asked for are valid: others can be anything on NFS or FUSE
+static void statx_to_stat(const struct statx *x, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = x->stx_mode;
+    st->st_ino = x->stx_ino;
+    st->st_dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+    st->st_nlink = (x->stx_mask & STATX_NLINK) ? x->stx_nlink : 1;
+    st->st_size = (off_t)x->stx_size;
+    st->st_blocks = (blkcnt_t)x->stx_blocks;
+    st->st_mtim.tv_sec = x->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = x->stx_mtime.tv_nsec;
+    st->st_ctim.tv_sec = x->stx_ctime.tv_sec;
+    st->st_ctim.tv_nsec = x->stx_ctime.tv_nsec;
+}
+
+static void stat_sync(int dfd, UringStat *req) {
+    req->err = fstatat(dfd, req->name, req->st, req->follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 ? 0 : errno;
+}
+
+bool uring_stat_batch(int dfd, UringStat *reqs, size_t n, unsigned want) {
+    Ring *r = get_ring();
+    if (!r) return false;
+    if (n == 0) return true;
+
+    if (r->bufs_cap < n) {
+        free(r->bufs);
+        r->bufs_cap = n * 2;
+        r->bufs = xmalloc(r->bufs_cap * sizeof(struct statx));
+    }
+
+    unsigned mask = STATX_TYPE | STATX_MODE | STATX_INO;
+    if (want & URING_WANT_SIZE) mask |= STATX_SIZE | STATX_BLOCKS;
+    if (want & URING_WANT_TIMES) mask |= STATX_MTIME | STATX_CTIME;
+    if (want & URING_WANT_NLINK) mask |= STATX_NLINK;
+
+    for (size_t i = 0; i < n; i++)
+        reqs[i].err = -1;                   // not completed yet
+
+    size_t queued = 0, done = 0;
+    unsigned in_flight = 0;
+    while (done < n) {
+        // Fill the submission queue
+        unsigned tail = *r->sq_tail;
+        while (queued < n && in_flight < r->sq_entries) {
+            unsigned idx = tail & *r->sq_mask;
+            struct io_uring_sqe *sqe = &r->sqes[idx];
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = dfd;
+            sqe->addr = (uint64_t)(uintptr_t)reqs[queued].name;
+            sqe->len = mask;
+            sqe->off = (uint64_t)(uintptr_t)&r->bufs[queued];
+            sqe->statx_flags = reqs[queued].follow ? 0 : AT_SYMLINK_NOFOLLOW;
+            sqe->user_data = queued;
+            r->sq_array[idx] = idx;
+            tail++;
+            queued++;
+            in_flight++;
+        }
+        __atomic_store_n(r->sq_tail, tail, __ATOMIC_RELEASE);
+
+        // Submit whatever the kernel hasn't consumed yet and wait for at least one
+        unsigned pending = tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        if (syscall(__NR_io_uring_enter, r->fd, pending, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0
+            && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            // The ring stopped working: finish the batch the slow way, and don't use
+            // the ring again (requests still in flight may yet write to it)
+            thread_ring = NULL;
+            ring_unavailable = true;
+            pthread_setspecific(ring_key, NULL);
+            for (size_t i = 0; i < n; i++)
+                if (reqs[i].err == -1) stat_sync(dfd, &reqs[i]);
+            return true;
+        }
+
+        // Reap completions
+        unsigned head = *r->cq_head;
+        unsigned ctail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != ctail; head++) {
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            UringStat *req = &reqs[cqe->user_data];
+            const struct statx *x = &r->bufs[cqe->user_data];
+            if (cqe->res < 0) req->err = -cqe->res;
+            else if ((x->stx_mask & mask) != mask) stat_sync(dfd, req);   // a field wasn't filled in
+            else {
+                req->err = 0;
+                statx_to_stat(x, req->st);
+            }
+            done++;
+            in_flight--;
+        }
+        __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
@@ -0,0 +1,32 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// -------------------- io_uring stat batches (Linux, make SCAN_BACKEND=uring) --------------------
+// Runs a batch of fstatat() equivalents as IORING_OP_STATX requests, keeping up to
+// URING_QUEUE_DEPTH of them in flight at once, and waits for the whole batch. Each
+// thread gets its own ring on first use. Built on the raw system calls, so there is
+// no liburing dependency.
+
+#define URING_QUEUE_DEPTH 256
+
+// Fields wanted on top of type/mode, dev and ino
+#define URING_WANT_SIZE   0x01    // st_size, st_blocks
+#define URING_WANT_TIMES  0x02    // st_mtime, st_ctime
+#define URING_WANT_NLINK  0x04    // st_nlink (otherwise 1)
+
+typedef struct UringStat {
+    const char *name;           // Entry name relative to the directory fd
+    bool follow;                // Follow symlinks (stat) rather than lstat
+    struct stat *st;            // Filled in on success
+    int err;                    // 0 or the errno of the failed call
+} UringStat;
+
+// Returns false (results untouched) if io_uring can't be used, e.g. on an old
+// kernel or where it is disabled; the caller then stats the batch itself.
+bool uring_stat_batch(int dfd, UringStat *reqs, size_t n, unsigned want);
+
+#endif
@@ -7,7 +7,9 @@
 #include <libgen.h>     // For basename if needed (not used here)
 #include <unistd.h>     // For readlink (POSIX)
 #include <inttypes.h>   // For intmax_t
+#include <pthread.h>    // For pthread_mutex_t
 #include "memsafe.h"
+#include "arena.h"
 #include "gtree.h"
 #include "visit_hash.h"
 #include "khashl.h"
@@ -46,19 +48,37 @@ static inline khint_t dev_ino_hash(VisitedHash k) {
 // The macro will define a structure named 'kh_visited_set_t' (from the second parameter).
 KHASHL_SET_INIT(static kh_inline klib_unused, visited_set, visited_set, VisitedHash, dev_ino_hash, dev_ino_equal)
 
-typedef visited_set vnode_set_t; // Use the generated type name
-vnode_set_t *nhash = NULL;
+struct VisitedSet {
+    visited_set *h;
+    bool shared;                // Walks on several threads use it: every lookup takes lock
+    pthread_mutex_t lock;
+};
 
 // ------------------- Visited hash functions ------------------
-void create_visited_node_hash() {
-	nhash = visited_set_init();
+VisitedSet *create_visited_node_hash(size_t expect) {
+	VisitedSet *set = xmalloc(sizeof(VisitedSet));
+	set->h = visited_set_init();
+	// Room for expect keys below the 75% load factor, so the walk never stops to rehash
+	if (expect > 0 && expect < (size_t)1 << 30)
+		visited_set_resize(set->h, (khint_t)(expect + expect / 3 + 1));
+	set->shared = false;
+	return set;
 }
 
-int add_visited(dev_t dev, ino_t ino) {
+VisitedSet *create_shared_visited(size_t expect) {
+	VisitedSet *set = create_visited_node_hash(expect);
+	set->shared = true;
+	pthread_mutex_init(&set->lock, NULL);
+	return set;
+}
+
+int add_visited(VisitedSet *set, dev_t dev, ino_t ino) {
 	VisitedHash key = { .st_dev = dev, .st_ino = ino };
 	int absent;
 	// The put function is prefix_put, which is visited_set_put
-	visited_set_put(nhash, key, &absent);
+	if (set->shared) pthread_mutex_lock(&set->lock);
+	visited_set_put(set->h, key, &absent);
+	if (set->shared) pthread_mutex_unlock(&set->lock);
 	// absent == 0: Key already existed (visited before).
 	// absent == 1: Key is new and inserted.
 	return absent;
@@ -66,14 +86,64 @@ int add_visited(dev_t dev, ino_t ino) {
 
 
 // Checks if a directory (identified by its unique dev/ino pair) has been visited before.
-bool visited_before(dev_t dev, ino_t ino) {
+bool visited_before(VisitedSet *set, dev_t dev, ino_t ino) {
     VisitedHash key = { .st_dev = dev, .st_ino = ino };
-    khint_t k = visited_set_get(nhash, key);
-    return k != kh_end(nhash);
+    if (set->shared) pthread_mutex_lock(&set->lock);
+    bool found = visited_set_get(set->h, key) != kh_end(set->h);
+    if (set->shared) pthread_mutex_unlock(&set->lock);
+    return found;
+}
+
+size_t visited_count(const VisitedSet *set) {
+    return kh_size(set->h);
+}
+
+void visited_each(const VisitedSet *set, void (*fn)(void *ctx, dev_t dev, ino_t ino), void *ctx) {
+    khint_t k;
+    kh_foreach(set->h, k)
+        fn(ctx, kh_key(set->h, k).st_dev, kh_key(set->h, k).st_ino);
 }
 
 // Frees all memory used by the visited directories linked list.
-void free_visited_node_hash() {
-    visited_set_destroy(nhash);
+void free_visited_node_hash(VisitedSet *set) {
+    if (!set) return;
+    if (set->shared) pthread_mutex_destroy(&set->lock);
+    visited_set_destroy(set->h);
+    free(set);
 }
 
+// ------------------- Link target cache ------------------
+KHASHL_MAP_INIT(static kh_inline klib_unused, link_map, link_map, VisitedHash, const char *, dev_ino_hash, dev_ino_equal)
+
+struct LinkTargets {
+    link_map *h;
+    Arena strings;              // The targets
+};
+
+LinkTargets *create_link_targets(void) {
+    LinkTargets *lt = xmalloc(sizeof(LinkTargets));
+    lt->h = link_map_init();
+    lt->strings = (Arena){0};
+    return lt;
+}
+
+const char *cached_link_target(const LinkTargets *lt, dev_t dev, ino_t ino) {
+    VisitedHash key = { .st_dev = dev, .st_ino = ino };
+    khint_t k = link_map_get(lt->h, key);
+    return k == kh_end(lt->h) ? NULL : kh_val(lt->h, k);
+}
+
+const char *cache_link_target(LinkTargets *lt, dev_t dev, ino_t ino, const char *target) {
+    VisitedHash key = { .st_dev = dev, .st_ino = ino };
+    int absent;
+    khint_t k = link_map_put(lt->h, key, &absent);
+    if (absent) kh_val(lt->h, k) = arena_strdup(&lt->strings, target);
+    return kh_val(lt->h, k);
+}
+
+void free_link_targets(LinkTargets *lt) {
+    if (!lt) return;
+    link_map_destroy(lt->h);
+    arena_free(&lt->strings);
+    free(lt);
+}
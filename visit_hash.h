@@ -1,14 +1,43 @@
 #ifndef VISIT_HASH_H
 #define VISIT_HASH_H
 
+#include <stdbool.h>
+#include <stddef.h>     // For size_t
+#include <sys/types.h>  // For dev_t, ino_t
+
 // -------------------- Loop Detection: visited directories linked list --------------------
 // Stores inode/device ID pairs of all directories that have been successfully entered.
-// Used to detect and avoid infinite loops when following symlinks.
+// Used to detect and avoid infinite loops when following symlinks. Each walk has
+// its own set, unless several roots share one (so what they have in common is
+// walked once); -H keeps a second one of the files with st_nlink > 1, so the first
+// name reached for each of them is the one whose size is counted.
+
+typedef struct VisitedSet VisitedSet;
+
+// expect: number of entries to size the table for up front (0: grow as needed)
+VisitedSet *create_visited_node_hash(size_t expect);
+// A set walks running on several threads at once can use (every call is locked)
+VisitedSet *create_shared_visited(size_t expect);
+void free_visited_node_hash(VisitedSet *set);
+// Returns 1 if dev/ino was added, 0 if it was in the set already
+int add_visited(VisitedSet *set, dev_t dev, ino_t ino);
+bool visited_before(VisitedSet *set, dev_t dev, ino_t ino);
+// Every dev/ino in the set, in no particular order (--checkpoint; not while it is shared)
+size_t visited_count(const VisitedSet *set);
+void visited_each(const VisitedSet *set, void (*fn)(void *ctx, dev_t dev, ino_t ino), void *ctx);
+
+// -------------------- Link targets by symlink inode --------------------
+// A symlink can't be changed, only replaced, so its target is fixed for its dev/ino.
+// Kept when a walk may reach the same links again (-l without a visited set).
+
+typedef struct LinkTargets LinkTargets;
 
-void create_visited_node_hash();
-void free_visited_node_hash();
-int add_visited(dev_t dev, ino_t ino);
-bool visited_before(dev_t dev, ino_t ino);
+LinkTargets *create_link_targets(void);
+void free_link_targets(LinkTargets *lt);
+// The target stored for symlink dev/ino, NULL if there is none
+const char *cached_link_target(const LinkTargets *lt, dev_t dev, ino_t ino);
+// Stores a copy of target, which is returned
+const char *cache_link_target(LinkTargets *lt, dev_t dev, ino_t ino, const char *target);
 
 #endif  
 
@@ -0,0 +1,1105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <dirent.h>     // For DIR, fdopendir, closedir (POSIX)
+#include <string.h>     // For memset
+#include <sys/stat.h>   // For struct stat, fstat, fstatat, S_ISDIR (POSIX)
+#include <unistd.h>     // For close (POSIX)
+#include <fcntl.h>      // For openat, fstatat, O_DIRECTORY, AT_FDCWD (POSIX)
+#include <errno.h>      // For errno, EMFILE, ENFILE
+#include <limits.h>     // For PATH_MAX
+#include "gtree.h"
+#include "visit_hash.h"
+#include "option_parsing.h"
+#include "memsafe.h"
+#include "checkpoint.h"
+#include "filter.h"
+#include "scan.h"
+#include "scan_pool.h"
+#include "snapshot.h"
+#include "timing.h"
+#include "walk.h"
+
+struct Walk {
+    const Options *opts;
+    const WalkVisitor *visitor;
+    DirFrame *stack[MAX_DEPTH + 2];         // Explicit stack for DirFrame pointers (simulate recursion)
+    int sp;                                 // stack pointer: next free slot
+    // One arena per stack slot holds that level's frame and subdirectory list, plus a
+    // scratch arena for the -f file list, which is dropped as soon as it is visited
+    Arena arenas[MAX_DEPTH + 2];
+    Arena file_arena;
+    bool ancestor_siblings[MAX_DEPTH + 2];  // Tree branch state shared by all frames, indexed by depth
+    FdBudget fds;                           // Directory fds held by frames on the stack
+    ScanPool *pool;                         // -P N workers scanning ahead, else NULL
+    Snapshot *since;                        // --since: earlier walk whose listings are reused
+    bool own_since;                         // Loaded by the walk (rather than lent to it)
+    SnapshotWriter *snap;                   // --save-snapshot, or the walk kept in memory
+    bool record;                            // Keep the snapshot in memory (walk_create_recorded)
+    Snapshot *kept;                         // Which ends up here, once the walk is complete
+    long snap_entries;
+    VisitedSet *visited;                    // Directories entered (loop detection), NULL if only the stack is
+    bool lent_visited;                      // visited is shared with other walks (walk_create_shared)
+    VisitedSet *linked;                     // -H: files with several links already counted
+    LinkTargets *links;                     // Directory link targets read, -l without a visited set
+    char *root_path;                        // Starting directory, which evicted frames are reopened from
+    dev_t root_dev;                         // For -x
+    // --breadth-first: the frames of the level being built, in walk order
+    DirFrame **next_level;
+    size_t next_count, next_cap;
+    uint64_t checkpoint_due;                // --checkpoint: time the next one is saved (0: none)
+    bool resumed;                           // Started from a checkpoint (walk_resume)
+    uint64_t resumed_data[WALK_CHECKPOINT_DATA];    // The visitor's part of it
+    ActivityReport report;
+};
+
+// Calls visitor callback cb with its context, if there is one
+#define VISIT(w, cb, ...) do { \
+        if ((w)->visitor->cb) (w)->visitor->cb((w)->visitor->ctx, __VA_ARGS__); \
+    } while (0)
+
+// ----------------- Directory fd budget -----------------
+// Frames keep their directory fd after the Phase 1 scan so children can be opened
+// with openat(). At most fds->limit of them are held: when the budget is full the
+// oldest (shallowest) frame gives its fd up and reopens it if it is needed again.
+// Peak usage is therefore bounded by the budget rather than by depth.
+static void fd_opened(FdBudget *fds, ActivityReport *report) {
+    fds->in_use++;
+    if (report->TOTAL_peak_fds < fds->in_use)
+        report->TOTAL_peak_fds = fds->in_use;
+}
+
+static void fd_close(FdBudget *fds, int *fd) {
+    if (*fd == -1) return;
+    close(*fd);
+    *fd = -1;
+    fds->in_use--;
+}
+
+// Close the fd of the oldest frame below stack[keep]. Returns false if none is held.
+static bool fd_evict(FdBudget *fds, DirFrame **stack, int keep) {
+    for (int i = fds->floor; i < keep; i++) {
+        if (stack[i]->fd != -1) {
+            fd_close(fds, &stack[i]->fd);
+            fds->floor = i + 1;
+            return true;
+        }
+    }
+    fds->floor = keep;
+    return false;
+}
+
+// Open a directory relative to dfd, staying within the budget. An EMFILE/ENFILE
+// failure (fds used by whoever ran us) evicts another frame fd and retries.
+static int open_dir_fd(int dfd, const char *name, DirFrame **stack, int keep,
+                       FdBudget *fds, ActivityReport *report) {
+    if (fds->in_use >= fds->limit)
+        fd_evict(fds, stack, keep);
+    int fd;
+    uint64_t t = timing_start();
+    while ((fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1
+           && (errno == EMFILE || errno == ENFILE)) {
+        if (!fd_evict(fds, stack, keep)) break;
+    }
+    timing_record(TIME_OPENDIR, t);
+    if (fd != -1) fd_opened(fds, report);
+    return fd;
+}
+
+// Open rel, a path below directory dfd, one name at a time, so that no call is given
+// more than a single name however deep the tree is (a whole path may exceed PATH_MAX).
+// Frames from stack[keep] up keep their fds meanwhile. Takes over dfd if own is set.
+static int open_below(Walk *w, int dfd, bool own, const char *rel, int keep) {
+    char name[NAME_MAX + 1];
+    while (*rel) {
+        size_t len = strcspn(rel, "/");
+        int fd = -1;
+        if (len > NAME_MAX) errno = ENAMETOOLONG;
+        else {
+            memcpy(name, rel, len);
+            name[len] = '\0';
+            fd = open_dir_fd(dfd, name, w->stack, keep, &w->fds, &w->report);
+        }
+        int err = errno;
+        if (own) fd_close(&w->fds, &dfd);
+        if (fd == -1) {
+            errno = err;
+            return -1;
+        }
+        dfd = fd;
+        own = true;
+        rel += len + (rel[len] == '/');
+    }
+    return dfd;
+}
+
+// Reopen an evicted frame, stack[idx], from the nearest frame below it that still holds
+// its fd, or else from the starting directory. Paths are joined with one '/' per level,
+// so what follows an ancestor's path names the directories in between.
+static int reopen_frame(Walk *w, const DirFrame *frame, int idx) {
+    for (int i = idx - 1; i >= 0; i--)
+        if (w->stack[i]->fd != -1)
+            return open_below(w, w->stack[i]->fd, false, frame->path + strlen(w->stack[i]->path) + 1, i);
+
+    int keep = idx < 0 ? 0 : idx;
+    int root = open_dir_fd(AT_FDCWD, w->root_path, w->stack, keep, &w->fds, &w->report);
+    size_t len = strlen(w->root_path);
+    if (root == -1 || !frame->path[len]) return root;
+    return open_below(w, root, true, frame->path + len + 1, keep);
+}
+
+// Return the directory fd of frame, stack[idx], reopening it if it was evicted.
+// With --breadth-first (idx -1) there is no stack: a frame that couldn't keep its fd
+// after the scan is reopened (from the starting directory) once, to process its
+// subdirectories.
+static int frame_fd(Walk *w, DirFrame *frame, int idx) {
+    if (frame->fd == -1) {
+        frame->fd = reopen_frame(w, frame, idx);
+        if (frame->fd == -1) VISIT(w, error, frame->path, errno);
+        else if (idx >= 0 && w->fds.floor > idx) w->fds.floor = idx;
+    }
+    return frame->fd;
+}
+
+// ----------------- Create a new directory frame -----------------
+// Allocates and initializes a new DirFrame, simulating a push onto an explicit stack.
+// For the root, dirName is the starting path; otherwise it is the entry name of the
+// subdirectory. fd is the already opened directory, which the frame takes over.
+// The frame lives in 'arena' (empty on entry), which is reset when the frame is popped.
+// The root frame supplies the shared ancestor_siblings array; children inherit it.
+static DirFrame *Create_Frame(const char *dirName, int dirDepth, const DirFrame *parent, bool is_last, int fd,
+                              Arena *arena, bool *ancestor_siblings) {
+    DirFrame *framePtr = arena_alloc(arena, sizeof(DirFrame));
+
+    framePtr->depth = dirDepth;
+    framePtr->is_last = is_last;
+    framePtr->fd = fd;
+    framePtr->arena = arena;
+
+    // Share ancestor_siblings with the parent for correct tree formatting
+    framePtr->ancestor_siblings = parent ? parent->ancestor_siblings : ancestor_siblings;
+
+    // Path string is kept for printing only
+    framePtr->path = parent ? join_path(arena, parent->path, dirName) : arena_strdup(arena, dirName);
+
+    // Initialize Phase 1 (scanning) variables
+    framePtr->subdirs = NULL;
+    framePtr->subdir_count = framePtr->subdir_cap = 0;
+    framePtr->current = 0;
+    framePtr->subfiles = NULL;
+    framePtr->subfile_count = framePtr->subfile_cap = 0;
+    framePtr->linked = NULL;
+    framePtr->linked_count = framePtr->linked_cap = 0;
+    framePtr->dir_file_count = 0;
+    framePtr->dir_file_size = 0;
+    framePtr->dir_file_blocks = 0;
+    framePtr->tree_file_count = 0;
+    framePtr->tree_file_size = 0;
+    framePtr->tree_blocks = 0;
+    framePtr->printed = false;
+    framePtr->is_symlink = false;
+    framePtr->sym_path = NULL;
+    framePtr->dev = 0;
+    framePtr->ino = 0;
+    framePtr->scan_ns = 0;
+    framePtr->timed_out = false;
+    framePtr->read_err = 0;
+    framePtr->job = NULL;
+    framePtr->since = -1;
+
+    return framePtr;
+}
+
+// ----------------- Open and create a child frame -----------------
+// Opens subdirectory n of parent (the frame at the top of the stack) and wraps it in
+// a new DirFrame built in the next slot's arena, or with --breadth-first in the arena
+// of the next level. Returns NULL (with *err set) if the directory can't be opened.
+// If a scan worker already opened (and scanned) it, the child takes over n's ScanJob
+// instead and holds no fd of its own.
+static DirFrame *open_child(Walk *w, DirFrame *parent, SubDirNode *n, bool is_last, int *err) {
+    ScanJob *job = n->job;
+    int fd = -1;
+    uint64_t open_ns = 0;
+
+    n->job = NULL;
+    if (job) {
+        scan_pool_wait(w->pool, job);
+        if (job->err) {
+            *err = job->err;
+            scan_pool_release(w->pool, job);
+            return NULL;
+        }
+    } else {
+        uint64_t t = timing_start();
+        fd = open_dir_fd(parent->fd, n->name, w->stack, w->sp > 0 ? w->sp - 1 : 0, &w->fds, &w->report);
+        if (t) open_ns = timing_now() - t;
+        if (fd == -1) {
+            *err = errno;
+            return NULL;
+        }
+    }
+    Arena *arena = w->opts->breadth_first ? &w->arenas[(parent->depth + 1) % 2] : &w->arenas[w->sp];
+    DirFrame *child = Create_Frame(n->name, parent->depth + 1, parent, is_last, fd, arena, NULL);
+    child->job = job;
+    child->scan_ns = open_ns;
+    return child;
+}
+
+// ----------------- Release a directory frame -----------------
+// Closes the frame's directory fd (if still held) and resets its arena, which
+// releases the frame, its path and its subdirectory list in one go
+static void Free_Frame(DirFrame *frame, FdBudget *fds, ScanPool *pool) {
+    fd_close(fds, &frame->fd);
+    if (frame->job) scan_pool_release(pool, frame->job);
+    arena_reset(frame->arena);
+}
+
+// ----------------- Parallel scan helpers -----------------
+// Take over the Phase 1 result a scan worker produced for this frame
+static void adopt_scan(DirFrame *frame, ScanPool *pool, ActivityReport *report) {
+    ScanJob *job = frame->job;
+    scan_pool_wait(pool, job);
+    frame->subdirs = job->frame.subdirs;
+    frame->subdir_count = job->frame.subdir_count;
+    frame->current = 0;
+    frame->subfiles = job->frame.subfiles;
+    frame->subfile_count = job->frame.subfile_count;
+    frame->linked = job->frame.linked;
+    frame->linked_count = job->frame.linked_count;
+    frame->dir_file_count = job->frame.dir_file_count;
+    frame->dir_file_size = job->frame.dir_file_size;
+    frame->dir_file_blocks = job->frame.dir_file_blocks;
+    frame->scan_ns = job->frame.scan_ns;
+    frame->timed_out = job->frame.timed_out;
+    frame->read_err = job->frame.read_err;
+    report->TOTAL_file_count += job->report.TOTAL_file_count;
+    report->TOTAL_linked_files += job->report.TOTAL_linked_files;
+    report->TOTAL_file_size += job->report.TOTAL_file_size;
+    report->TOTAL_stat_avoided += job->report.TOTAL_stat_avoided;
+    report->TOTAL_blocks += job->report.TOTAL_blocks;
+    report->TOTAL_timeouts += job->report.TOTAL_timeouts;
+}
+
+// Cancel the scan of subdirectories we are not going to descend into
+static void drop_jobs(ScanPool *pool, SubDirNode *from, const SubDirNode *to) {
+    for (SubDirNode *n = from; n != to; n++) {
+        if (n->job) {
+            scan_pool_abandon(pool, n->job);
+            n->job = NULL;
+        }
+    }
+}
+
+// ----------------- Loop detection -----------------
+// --visited=all keeps every directory reached in w->visited. Otherwise (ancestors, and
+// auto without -l) there is no set: a directory can only loop back to one of the
+// frames being walked, so the stack is searched instead, in memory bounded by depth.
+static bool on_stack(const Walk *w, dev_t dev, ino_t ino) {
+    for (int i = w->sp - 1; i >= 0; i--)
+        if (w->stack[i]->ino == ino && w->stack[i]->dev == dev) return true;
+    return false;
+}
+
+// Reached before (--visited=all), or an ancestor of the directory being walked
+static bool seen_dir(const Walk *w, dev_t dev, ino_t ino) {
+    return w->visited ? visited_before(w->visited, dev, ino) : on_stack(w, dev, ino);
+}
+
+// Record a directory reached; returns true if it counts as a new one
+static bool note_dir(Walk *w, dev_t dev, ino_t ino) {
+    return w->visited ? add_visited(w->visited, dev, ino) : !on_stack(w, dev, ino);
+}
+
+// A set shared with other walks (walk_create_shared) is checked and added to in one
+// step, under its lock: of two walks reaching a directory at the same time, only the
+// one that added it finds it new and goes in, the other shows it as [recursive].
+// Returns true if it was new. Such a directory counts as reached even if it then
+// fails to open.
+static bool claim_dir(Walk *w, dev_t dev, ino_t ino) {
+    return add_visited(w->visited, dev, ino);
+}
+
+// The same checks for a subtree taken whole from the --since snapshot (--watch)
+static bool copy_seen(void *ctx, dev_t dev, ino_t ino) {
+    return seen_dir(ctx, dev, ino);
+}
+
+static void copy_note(void *ctx, dev_t dev, ino_t ino) {
+    note_dir(ctx, dev, ino);
+}
+
+// ----------------- Hard links (-H) -----------------
+// Take every further link to an already counted file back out of the directory's
+// size, before anything shows it. Runs in walk order, so the first name counts.
+static void dedup_linked_files(DirFrame *frame, VisitedSet *linked, ActivityReport *report) {
+    for (size_t i = 0; i < frame->linked_count; i++) {
+        const LinkedFile *lf = &frame->linked[i];
+        if (add_visited(linked, lf->dev, lf->ino)) continue;
+        frame->dir_file_size -= lf->size;
+        frame->dir_file_blocks -= lf->blocks;
+        report->TOTAL_blocks -= lf->blocks;
+        report->TOTAL_dup_links++;
+        report->TOTAL_dup_size += lf->size;
+    }
+}
+
+// ----------------- Subtree totals (--du, --top) -----------------
+// A newly pushed directory starts its totals with its own blocks
+static void du_start(DirFrame *frame, const struct stat *st, ActivityReport *report) {
+    frame->tree_blocks = st->st_blocks;
+    report->TOTAL_blocks += st->st_blocks;
+}
+
+// The subtree is complete: add the frame's own files and pass the totals up
+static void subtree_finish(DirFrame *frame, DirFrame *parent) {
+    frame->tree_file_count += frame->dir_file_count;
+    frame->tree_file_size += frame->dir_file_size;
+    frame->tree_blocks += frame->dir_file_blocks;
+    if (parent) {
+        parent->tree_file_count += frame->tree_file_count;
+        parent->tree_file_size += frame->tree_file_size;
+        parent->tree_blocks += frame->tree_blocks;
+    }
+}
+
+// ----------------- Resolve a subdirectory's identity -----------------
+// Fills st_target with the dev/ino/mode/times of the (followed) directory. Uses the values
+// cached in Phase 1 unless there are none or strict mode asks for a fresh stat().
+// With -P the scan worker that opened the directory has already fstat()ed it.
+static bool subdir_stat(int dfd, const SubDirNode *n, bool strict, ScanPool *pool,
+                        struct stat *st_target) {
+    if (n->has_stat && !strict) {
+        st_target->st_dev = n->dev;
+        st_target->st_ino = n->ino;
+        st_target->st_mode = n->mode;
+        ST_MTIM(st_target) = n->mtime;
+        ST_CTIM(st_target) = n->ctime;
+        st_target->st_blocks = n->blocks;
+        return true;
+    }
+    if (n->job && !strict) {
+        scan_pool_wait(pool, n->job);
+        *st_target = n->job->st;
+        return n->job->stat_ok;
+    }
+    uint64_t t = timing_start();
+    bool ok = fstatat(dfd, n->name, st_target, 0) == 0; // follow symlink
+    timing_record(TIME_STAT, t);
+    return ok;
+}
+
+// ----------------- Set up -----------------
+static char *copy_string(const char *s) {
+    char *copy = xmalloc(strlen(s) + 1);
+    strcpy(copy, s);
+    return copy;
+}
+
+// A set of every directory reached is kept for --visited=all, and for auto with -l
+static bool keeps_visited(const Options *opts) {
+    return opts->visited == VISITED_ALL || opts->breadth_first ||
+           (opts->visited == VISITED_AUTO && opts->follow_links);
+}
+
+// since and record come from walk_create_recorded(), shared from walk_create_shared()
+static Walk *walk_open(const char *root_path, const Options *opts, const WalkVisitor *visitor,
+                       Snapshot *since, bool record, VisitedSet *shared) {
+    Walk *w = xcalloc(1, sizeof(Walk));
+    w->opts = opts;
+    w->visitor = visitor;
+    w->fds = (FdBudget){ .limit = opts->fd_budget, .in_use = 0, .floor = 0 };
+
+    // Earlier walk whose unchanged directory listings are reused (--since)
+    w->since = since;
+    w->record = record;
+    if (!since && opts->since) {
+        if (!(w->since = snapshot_load(opts->since, opts->follow_links))) {
+            free(w);
+            errno = 0;
+            return NULL;
+        }
+        w->own_since = true;
+    }
+
+    // Worker threads scanning directories ahead of the main loop (-P N); they would
+    // read the directories --since doesn't need to
+    if (opts->parallel > 0 && !w->since) w->pool = scan_pool_create(opts->parallel, opts);
+
+    // Create root frame & push onto stack
+    uint64_t root_open = timing_start();
+    int root_fd = open(root_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    uint64_t root_opened = timing_record(TIME_OPENDIR, root_open);
+    if (root_fd == -1) {
+        int err = errno;
+        walk_free(w);
+        errno = err;
+        return NULL;
+    }
+    fd_opened(&w->fds, &w->report);
+    w->root_path = copy_string(root_path);
+    DirFrame *root = Create_Frame(root_path, 0, NULL, false, root_fd, &w->arenas[0], w->ancestor_siblings);
+    root->scan_ns = root_opened - root_open;
+    w->stack[w->sp++] = root;
+
+    // Hash table to track visited directories to prevent infinite recursion via symlinks,
+    // sized from the snapshot when there is one
+    if (keeps_visited(opts)) {
+        size_t expect = opts->expect_dirs ? opts->expect_dirs : w->since ? snapshot_dir_count(w->since) : 0;
+        w->visited = shared ? shared : create_visited_node_hash(expect);
+        w->lent_visited = shared != NULL;
+    }
+    if (opts->dedup_links) w->linked = create_visited_node_hash(0);
+    // Without a visited set the same links can be reached again, through other paths
+    if (opts->follow_links && !w->visited && !opts->no_link_targets) w->links = create_link_targets();
+
+    // Record root directory's unique device/inode ID in case symlinks loop back to it
+    struct stat st_root;
+    bool root_stat_ok = fstat(root->fd, &st_root) == 0;
+    if (root_stat_ok) {
+        note_dir(w, st_root.st_dev, st_root.st_ino);
+        root->dev = w->root_dev = st_root.st_dev;
+        root->ino = st_root.st_ino;
+        if (w->pool && opts->one_file_system) scan_pool_limit_device(w->pool, st_root.st_dev);
+        if (w->since) root->since = snapshot_match(w->since, &st_root);
+        if (opts->du) du_start(root, &st_root, &w->report);
+    }
+
+    // Everything the walk reports is also recorded for --save-snapshot
+    if (record || opts->save_snapshot) {
+        w->snap = snapshot_create(record ? NULL : opts->save_snapshot, opts->follow_links);
+        snapshot_add_dir(w->snap, root_path, 0, false, NULL, root_stat_ok ? &st_root : NULL, true, false);
+    }
+    if (opts->checkpoint) w->checkpoint_due = timing_now() + (uint64_t)opts->checkpoint_ms * 1000000u;
+    return w;
+}
+
+Walk *walk_create(const char *root_path, const Options *opts, const WalkVisitor *visitor) {
+    return walk_open(root_path, opts, visitor, NULL, false, NULL);
+}
+
+Walk *walk_create_shared(const char *root_path, const Options *opts, const WalkVisitor *visitor,
+                         VisitedSet *visited) {
+    return walk_open(root_path, opts, visitor, NULL, false, visited);
+}
+
+Walk *walk_create_recorded(const char *root_path, const Options *opts, const WalkVisitor *visitor,
+                           Snapshot *since) {
+    return walk_open(root_path, opts, visitor, since, true, NULL);
+}
+
+// ----------------- Phase 1: Scan the directory on top of the stack -----------------
+static void scan_top(Walk *w, DirFrame *frame) {
+    const Options *opts = w->opts;
+    if (frame->job) {
+        // A scan worker already read this directory
+        adopt_scan(frame, w->pool, &w->report);
+    } else if (frame->since >= 0) {
+        // Unchanged since the snapshot: no need to read it
+        snapshot_reuse(w->since, frame->since, frame, opts, &w->report, &w->file_arena);
+        w->report.TOTAL_dirs_reused++;
+        frame->since = -1;
+        if (!frame->subdir_count || (opts->breadth_first && w->fds.in_use > w->fds.limit))
+            fd_close(&w->fds, &frame->fd);
+    } else {
+        w->report.TOTAL_dirs_reread++;
+        int dfd = frame->fd;
+
+        // The stream takes over the frame's fd for the duration of the scan
+        DIR *dir = fdopendir(dfd);
+        if (!dir) {
+            VISIT(w, error, frame->path, errno);
+            fd_close(&w->fds, &frame->fd);
+        }
+
+        // Read every entry, collecting subdirectories and (for -f) files
+        scan_directory(frame, dir, opts, &w->report, &w->file_arena);
+
+        // Close the stream now that every entry has been read. Only a frame with
+        // subdirectories to open keeps (a duplicate of) its fd, within the budget.
+        // Depth first the deepest frames need it most, so older ones are evicted;
+        // breadth first the frames queued first will be processed first.
+        if (dir) {
+            frame->fd = -1;
+            bool keep_fd = frame->subdir_count > 0;
+            if (keep_fd && w->fds.in_use >= w->fds.limit) {
+                if (opts->breadth_first) keep_fd = false;
+                else fd_evict(&w->fds, w->stack, w->sp - 1);
+            }
+            if (keep_fd) {
+                frame->fd = fcntl(dirfd(dir), F_DUPFD_CLOEXEC, 0);
+                if (frame->fd != -1) fd_opened(&w->fds, &w->report);
+            }
+            closedir(dir);
+            w->fds.in_use--;
+        }
+    }
+    if (frame->read_err) VISIT(w, error, frame->path, frame->read_err);
+}
+
+// The directory has been read: report it and its files, once, straight after the scan
+static void enter_top(Walk *w, DirFrame *frame) {
+    const Options *opts = w->opts;
+    frame->printed = true;
+
+    // Let the workers start on the subdirectories while the visitor runs
+    if (w->pool) scan_pool_prefetch(w->pool, frame, w->visited);
+
+    if (opts->dedup_links) dedup_linked_files(frame, w->linked, &w->report);
+
+    VISIT(w, enter_dir, frame);
+    if (w->snap) snapshot_add_files(w->snap, frame);
+
+    // Files in print order (last collected first)
+    if (w->visitor->file)
+        for (size_t i = frame->subfile_count; i-- > 0;)
+            w->visitor->file(w->visitor->ctx, frame, &frame->subfiles[i]);
+
+    if (opts->show_files || opts->top || opts->dedup_links) {
+        frame->subfiles = NULL;
+        frame->subfile_count = frame->subfile_cap = 0;
+        frame->linked = NULL;
+        frame->linked_count = frame->linked_cap = 0;
+        arena_reset(frame->job ? &frame->job->file_arena : &w->file_arena);
+    }
+}
+
+// Push child (just opened from the frame on top of the stack) as the next directory.
+// claimed: it is in the visited set already, added when it was found to be new.
+static void push_child(Walk *w, DirFrame *child, const struct stat *st_target, bool claimed) {
+    if (claimed || note_dir(w, st_target->st_dev, st_target->st_ino)) {
+        w->report.TOTAL_directories++;
+    }
+    if (w->since) child->since = snapshot_match(w->since, st_target);
+    child->dev = st_target->st_dev;
+    child->ino = st_target->st_ino;
+    if (w->opts->du) du_start(child, st_target, &w->report);
+    track_max_depth(&w->report, child->depth);
+    if (!w->opts->breadth_first) {
+        w->stack[w->sp++] = child;
+        return;
+    }
+
+    // Level by level: the child is read and reported right away and joins the next level,
+    // whose subdirectories are processed once this level's are done
+    scan_top(w, child);
+    enter_top(w, child);
+    if (w->next_count == w->next_cap)
+        w->next_level = arena_grow(child->arena, w->next_level, w->next_count, &w->next_cap,
+                                   sizeof(DirFrame *));
+    w->next_level[w->next_count++] = child;
+}
+
+// The target of directory link n in frame, read when the link is reported. Relative
+// to the frame's fd if it holds one (a scan worker may have opened n instead).
+static char *dir_link_target(Walk *w, DirFrame *frame, const SubDirNode *n, const char *path) {
+    bool cached = w->links && n->link_ino;
+    const char *target = cached ? cached_link_target(w->links, frame->dev, n->link_ino) : NULL;
+    if (target) return (char *)target;
+
+    char *read = frame->fd != -1 ? read_link_target(frame->arena, frame->fd, n->name)
+                                 : read_link_target(frame->arena, AT_FDCWD, path);
+    return cached ? (char *)cache_link_target(w->links, frame->dev, n->link_ino, read) : read;
+}
+
+// ----------------- Phase 2: Process the next subdirectory -----------------
+static void next_subdir(Walk *w, DirFrame *frame) {
+    const Options *opts = w->opts;
+    SubDirNode *cur = &frame->subdirs[frame->current];
+
+    // Nothing changed below a directory listed from a trusted snapshot (--watch): its
+    // subtree is recorded from it as it is, without opening anything. The visitor
+    // isn't told about it, and only TOTAL_dirs_reused counts it.
+    if (cur->since >= 0 && w->snap && !cur->is_symlink && !w->lent_visited) {
+        size_t copied = snapshot_copy_subtree(w->since, cur->since, w->snap, frame->depth + 1,
+                                              copy_seen, copy_note, w);
+        if (copied) {
+            w->report.TOTAL_dirs_reused += copied;
+            frame->current++;
+            return;
+        }
+    }
+
+    // A plain directory at the depth limit is only listed. If nothing needs its
+    // identity (a visited set to check, -x, --devices, a snapshot, -S), d_type has said enough.
+    bool list_only = !cur->is_symlink && !cur->has_stat && !cur->job
+                     && frame->depth + 1 >= opts->max_depth
+                     && !w->visited && !opts->one_file_system && !opts->show_devices && !w->snap
+                     && !opts->strict;
+
+    // Make sure we (still) hold this directory's fd; it may have been evicted.
+    // Not needed when a scan worker has already opened the subdirectory.
+    if (!list_only && (!cur->job || opts->strict)
+        && frame_fd(w, frame, opts->breadth_first ? -1 : w->sp - 1) == -1) {
+        drop_jobs(w->pool, cur, frame->subdirs + frame->subdir_count);
+        frame->current = frame->subdir_count; // can't reach the children any more
+        return;
+    }
+
+    frame->current++;                  // advance iterator
+    bool is_last_child = (frame->current == frame->subdir_count);
+
+    WalkEntry e = { .node = cur, .is_last = is_last_child };
+    if (list_only) {
+        DirFrame temp = {0};
+        if (w->visitor->subdir) temp.path = join_path(frame->arena, frame->path, cur->name);
+        temp.depth = frame->depth + 1;
+        temp.ancestor_siblings = frame->ancestor_siblings;
+        e.dir = &temp;
+        VISIT(w, subdir, frame, &e);
+        w->report.TOTAL_directories++;
+        w->report.TOTAL_stat_avoided++;
+        track_max_depth(&w->report, temp.depth);
+        return;
+    }
+
+    struct stat st_target;
+    bool stat_ok = subdir_stat(frame->fd, cur, opts->strict, w->pool, &st_target);
+    e.st = stat_ok ? &st_target : NULL;
+
+    // ---------------- Symlinked directories ----------------
+    if (cur->is_symlink) {
+        // Only traverse symlink if not visited, option allows, stat ok, AND depth limit not hit.
+        // With a set shared between walks, finding a directory new claims it (see claim_dir).
+        bool depth_limit_hit = (frame->depth + 1 >= opts->max_depth);
+        bool other_device = stat_ok && opts->one_file_system && st_target.st_dev != w->root_dev;
+        bool claim = w->lent_visited && opts->follow_links && stat_ok && !depth_limit_hit && !other_device;
+        bool already_visited = stat_ok && (claim ? !claim_dir(w, st_target.st_dev, st_target.st_ino)
+                                                 : seen_dir(w, st_target.st_dev, st_target.st_ino));
+
+        // Prepare temporary frame for printing
+        DirFrame temp = {0};
+        temp.path = join_path(frame->arena, frame->path, cur->name);
+        temp.depth = frame->depth + 1;
+        temp.ancestor_siblings = frame->ancestor_siblings;
+        if (!cur->sym_path && !opts->no_link_targets && (w->snap || link_target_shown(opts, temp.depth)))
+            cur->sym_path = dir_link_target(w, frame, cur, temp.path);
+
+        bool try_descend = !already_visited && opts->follow_links && stat_ok && !depth_limit_hit
+                           && !other_device;
+        if (other_device && !already_visited && opts->follow_links)
+            w->report.TOTAL_mounts_skipped++;
+
+        e.dir = &temp;
+        e.recursive = already_visited;
+        e.enter = try_descend;
+        VISIT(w, subdir, frame, &e);
+
+        // increment total linked directories even if not traversed
+        if (stat_ok) w->report.TOTAL_linked_directories++;
+
+        bool descended = false;
+        if (try_descend) {
+            int err;
+            DirFrame *child = open_child(w, frame, cur, is_last_child, &err);
+            if (child) {
+                child->is_symlink = true;
+                child->sym_path = cur->sym_path;
+                push_child(w, child, &st_target, claim);
+                descended = true;
+            } else {
+                VISIT(w, enter_failed, frame, &e, err);
+            }
+        } else {
+            // If we couldn't traverse because of depth limit but it's not a visit loop,
+            // still update the reported max depth if you want consistent "max reached" accounting:
+            if (!already_visited && depth_limit_hit) {
+                track_max_depth(&w->report, frame->depth + 1);
+            }
+        }
+        if (w->snap)
+            snapshot_add_dir(w->snap, cur->name, frame->depth + 1, true, cur->sym_path,
+                             stat_ok ? &st_target : NULL, descended, already_visited);
+
+        drop_jobs(w->pool, cur, cur + 1); // scan not needed if we didn't descend
+        return; // move to next subdirectory
+    }
+
+    // ---------------- Normal directories ----------------
+    if (stat_ok && S_ISDIR(st_target.st_mode)) {
+        bool claim = w->lent_visited;
+        bool already_visited = claim ? !claim_dir(w, st_target.st_dev, st_target.st_ino)
+                                     : seen_dir(w, st_target.st_dev, st_target.st_ino);
+        bool depth_limit_hit = (frame->depth + 1 >= opts->max_depth);
+        bool other_device = opts->one_file_system && st_target.st_dev != w->root_dev;
+
+        e.recursive = already_visited;
+        if (!already_visited && !depth_limit_hit && !other_device) {
+            // normal traversal
+            e.enter = true;
+            VISIT(w, subdir, frame, &e);
+            int err;
+            DirFrame *child = open_child(w, frame, cur, is_last_child, &err);
+            if (child) {
+                push_child(w, child, &st_target, claim);
+                if (w->snap)
+                    snapshot_add_dir(w->snap, cur->name, child->depth, false, NULL,
+                                     &st_target, true, false);
+            } else {
+                VISIT(w, enter_failed, frame, &e, err);
+            }
+        } else {
+            // only mark recursive if actually already visited
+            DirFrame temp = {0};
+            if (w->visitor->subdir) temp.path = join_path(frame->arena, frame->path, cur->name);
+            temp.depth = frame->depth + 1;
+            temp.ancestor_siblings = frame->ancestor_siblings;
+
+            e.dir = &temp;
+            VISIT(w, subdir, frame, &e);
+            if (w->snap)
+                snapshot_add_dir(w->snap, cur->name, temp.depth, false, NULL,
+                                 &st_target, false, already_visited);
+            if (claim ? !already_visited : note_dir(w, st_target.st_dev, st_target.st_ino)) {
+                w->report.TOTAL_directories++;
+                if (other_device) w->report.TOTAL_mounts_skipped++;
+            }
+            track_max_depth(&w->report, frame->depth + 1);
+        }
+    }
+    drop_jobs(w->pool, cur, cur + 1); // scan not needed if we didn't descend
+}
+
+// ------------------ Breadth first (--breadth-first) ------------------
+// Level by level instead of depth first: every directory of a level is reported
+// (with its files) before any of the next. A level's frames live in one of two
+// arenas, which is reset once the level below has been processed, so memory grows
+// with the widest level rather than the whole tree. A frame keeps its fd until its
+// subdirectories are processed if the budget allows, else it is reopened.
+static void walk_levels(Walk *w) {
+    DirFrame *root = w->stack[--w->sp];
+    scan_top(w, root);
+    enter_top(w, root);
+
+    DirFrame **level = &root;
+    size_t count = 1;
+    for (int depth = 0; count > 0; depth++) {
+        arena_reset(&w->arenas[(depth + 1) % 2]);   // frames two levels up are done
+        w->next_level = NULL;
+        w->next_count = w->next_cap = 0;
+        for (size_t i = 0; i < count; i++) {
+            DirFrame *frame = level[i];
+            while (frame->current < frame->subdir_count)
+                next_subdir(w, frame);
+            fd_close(&w->fds, &frame->fd);
+            VISIT(w, leave_dir, frame, NULL);
+            if (frame->job) scan_pool_release(w->pool, frame->job);
+            frame->job = NULL;
+        }
+        level = w->next_level;
+        count = w->next_count;
+    }
+}
+
+// ----------------- Checkpoints (--checkpoint, --resume) -----------------
+// Saved straight after a directory has been entered, when every frame on the stack
+// has been: what is left of the walk is then each frame's unprocessed subdirectories,
+// and everything before them has been reported. Frames come back without an fd
+// (they are reopened, as after an eviction) or scan jobs, and the link
+// target cache starts empty.
+
+// The options that change what is reported: a walk can only be resumed with the same
+static uint64_t options_key(const Options *o) {
+    const uint64_t v[] = {
+        o->show_file_stats, o->follow_links, o->show_hidden, o->show_files, o->colour_links,
+        o->colour_files, o->strict, (uint64_t)o->max_depth, (uint64_t)o->print_depth,
+        o->summary_only, o->output_format, o->sort, o->du, o->dedup_links, o->one_file_system,
+        o->visited, o->no_link_targets, o->timeout_ns, filter_digest(o->exclude), filter_digest(o->include)
+    };
+    uint64_t key = 14695981039346656037ull;
+    for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++)
+        key = (key ^ v[i]) * 1099511628211ull;     // FNV-1a, a value at a time
+    return key;
+}
+
+static void put_report(CheckpointFile *cf, const ActivityReport *r) {
+    const uint64_t v[] = {
+        r->TOTAL_file_count, r->TOTAL_linked_files, (uint64_t)r->TOTAL_file_size, r->TOTAL_directories,
+        r->TOTAL_linked_directories, (uint64_t)r->TOTAL_depth, r->TOTAL_stat_avoided,
+        (uint64_t)r->TOTAL_peak_fds, r->TOTAL_dirs_reread, r->TOTAL_dirs_reused, (uint64_t)r->TOTAL_blocks,
+        r->TOTAL_dup_links, (uint64_t)r->TOTAL_dup_size, r->TOTAL_mounts_skipped, r->TOTAL_timeouts
+    };
+    for (size_t i = 0; i < sizeof(v) / sizeof(v[0]); i++)
+        checkpoint_put(cf, v[i]);
+}
+
+static void get_report(CheckpointFile *cf, ActivityReport *r) {
+    r->TOTAL_file_count = checkpoint_get(cf);
+    r->TOTAL_linked_files = checkpoint_get(cf);
+    r->TOTAL_file_size = (off_t)checkpoint_get(cf);
+    r->TOTAL_directories = checkpoint_get(cf);
+    r->TOTAL_linked_directories = checkpoint_get(cf);
+    r->TOTAL_depth = (int)checkpoint_get(cf);
+    r->TOTAL_stat_avoided = checkpoint_get(cf);
+    r->TOTAL_peak_fds = (int)checkpoint_get(cf);
+    r->TOTAL_dirs_reread = checkpoint_get(cf);
+    r->TOTAL_dirs_reused = checkpoint_get(cf);
+    r->TOTAL_blocks = (blkcnt_t)checkpoint_get(cf);
+    r->TOTAL_dup_links = checkpoint_get(cf);
+    r->TOTAL_dup_size = (off_t)checkpoint_get(cf);
+    r->TOTAL_mounts_skipped = checkpoint_get(cf);
+    r->TOTAL_timeouts = checkpoint_get(cf);
+}
+
+static void put_dev_ino(void *ctx, dev_t dev, ino_t ino) {
+    checkpoint_put(ctx, (uint64_t)dev);
+    checkpoint_put(ctx, (uint64_t)ino);
+}
+
+static void put_set(CheckpointFile *cf, const VisitedSet *set) {
+    checkpoint_put(cf, set ? visited_count(set) : 0);
+    if (set) visited_each(set, put_dev_ino, cf);
+}
+
+// set is the one the resumed walk keeps (NULL if it has none)
+static void get_set(CheckpointFile *cf, VisitedSet *set) {
+    uint64_t n = checkpoint_get(cf);
+    if (n && !set) checkpoint_reject(cf);
+    for (uint64_t i = 0; i < n && !checkpoint_bad(cf); i++) {
+        dev_t dev = (dev_t)checkpoint_get(cf);
+        add_visited(set, dev, (ino_t)checkpoint_get(cf));
+    }
+}
+
+// A frame and the subdirectories it has left
+static void put_frame(CheckpointFile *cf, const DirFrame *f) {
+    checkpoint_put_str(cf, f->path);
+    checkpoint_put(cf, (uint64_t)f->depth);
+    checkpoint_put(cf, f->is_last);
+    checkpoint_put(cf, f->is_symlink);
+    checkpoint_put_str(cf, f->sym_path);
+    checkpoint_put(cf, (uint64_t)f->dev);
+    checkpoint_put(cf, (uint64_t)f->ino);
+    checkpoint_put(cf, f->dir_file_count);
+    checkpoint_put(cf, (uint64_t)f->dir_file_size);
+    checkpoint_put(cf, (uint64_t)f->dir_file_blocks);
+    checkpoint_put(cf, f->tree_file_count);
+    checkpoint_put(cf, (uint64_t)f->tree_file_size);
+    checkpoint_put(cf, (uint64_t)f->tree_blocks);
+    checkpoint_put(cf, f->timed_out);
+    checkpoint_put(cf, f->subdir_count - f->current);
+    for (size_t i = f->current; i < f->subdir_count; i++) {
+        const SubDirNode *n = &f->subdirs[i];
+        checkpoint_put_str(cf, n->name);
+        checkpoint_put(cf, n->is_symlink);
+        checkpoint_put_str(cf, n->sym_path);
+        checkpoint_put(cf, (uint64_t)n->link_ino);
+        checkpoint_put(cf, n->has_stat);
+        checkpoint_put(cf, (uint64_t)n->dev);
+        checkpoint_put(cf, (uint64_t)n->ino);
+        checkpoint_put(cf, n->mode);
+        checkpoint_put(cf, (uint64_t)n->mtime.tv_sec);
+        checkpoint_put(cf, (uint64_t)n->mtime.tv_nsec);
+        checkpoint_put(cf, (uint64_t)n->ctime.tv_sec);
+        checkpoint_put(cf, (uint64_t)n->ctime.tv_nsec);
+        checkpoint_put(cf, (uint64_t)n->blocks);
+    }
+}
+
+// Frame stack[i], built in its slot's arena as if it had just been entered
+static DirFrame *get_frame(CheckpointFile *cf, Walk *w, int i) {
+    Arena *arena = &w->arenas[i];
+    char *path = checkpoint_get_str(cf, &w->file_arena);
+    DirFrame *f = Create_Frame(path, i, NULL, false, -1, arena, w->ancestor_siblings);
+    if (checkpoint_get(cf) != (uint64_t)i) checkpoint_reject(cf);
+    f->is_last = checkpoint_get(cf);
+    f->is_symlink = checkpoint_get(cf);
+    f->sym_path = checkpoint_get_str(cf, arena);
+    f->dev = (dev_t)checkpoint_get(cf);
+    f->ino = (ino_t)checkpoint_get(cf);
+    f->dir_file_count = checkpoint_get(cf);
+    f->dir_file_size = (off_t)checkpoint_get(cf);
+    f->dir_file_blocks = (blkcnt_t)checkpoint_get(cf);
+    f->tree_file_count = checkpoint_get(cf);
+    f->tree_file_size = (off_t)checkpoint_get(cf);
+    f->tree_blocks = (blkcnt_t)checkpoint_get(cf);
+    f->timed_out = checkpoint_get(cf);
+    f->printed = true;
+    uint64_t left = checkpoint_get(cf);
+    for (uint64_t k = 0; k < left && !checkpoint_bad(cf); k++) {
+        if (f->subdir_count == f->subdir_cap)
+            f->subdirs = arena_grow(arena, f->subdirs, f->subdir_count, &f->subdir_cap, sizeof(SubDirNode));
+        SubDirNode *n = &f->subdirs[f->subdir_count++];
+        *n = (SubDirNode){0};
+        n->since = -1;
+        n->name = checkpoint_get_str(cf, arena);
+        n->is_symlink = checkpoint_get(cf);
+        n->sym_path = checkpoint_get_str(cf, arena);
+        n->link_ino = (ino_t)checkpoint_get(cf);
+        n->has_stat = checkpoint_get(cf);
+        n->dev = (dev_t)checkpoint_get(cf);
+        n->ino = (ino_t)checkpoint_get(cf);
+        n->mode = (mode_t)checkpoint_get(cf);
+        n->mtime.tv_sec = (time_t)checkpoint_get(cf);
+        n->mtime.tv_nsec = (long)checkpoint_get(cf);
+        n->ctime.tv_sec = (time_t)checkpoint_get(cf);
+        n->ctime.tv_nsec = (long)checkpoint_get(cf);
+        n->blocks = (blkcnt_t)checkpoint_get(cf);
+    }
+    return f;
+}
+
+static void save_checkpoint(Walk *w) {
+    uint64_t data[WALK_CHECKPOINT_DATA] = {0};
+    VISIT(w, checkpoint, data);
+    CheckpointFile *cf = checkpoint_create(w->opts->checkpoint);
+    if (!cf) return;
+
+    char cwd[PATH_MAX];
+    checkpoint_put(cf, options_key(w->opts));
+    checkpoint_put_str(cf, getcwd(cwd, sizeof(cwd)));
+    for (int i = 0; i < WALK_CHECKPOINT_DATA; i++)
+        checkpoint_put(cf, data[i]);
+    put_report(cf, &w->report);
+    checkpoint_put(cf, (uint64_t)w->root_dev);
+    checkpoint_put(cf, (uint64_t)w->sp);
+    for (int d = 0; d <= w->sp; d++)
+        checkpoint_put(cf, w->ancestor_siblings[d]);
+    for (int i = 0; i < w->sp; i++)
+        put_frame(cf, w->stack[i]);
+    put_set(cf, w->visited);
+    put_set(cf, w->linked);
+    checkpoint_commit(cf);
+}
+
+Walk *walk_resume(const char *file, const Options *opts, const WalkVisitor *visitor) {
+    CheckpointFile *cf = checkpoint_open(file);
+    errno = 0;
+    if (!cf) return NULL;
+    Walk *w = xcalloc(1, sizeof(Walk));
+    w->opts = opts;
+    w->visitor = visitor;
+    w->fds = (FdBudget){ .limit = opts->fd_budget, .in_use = 0, .floor = 0 };
+    w->resumed = true;
+
+    bool same_options = checkpoint_get(cf) == options_key(opts);
+    const char *started_in = checkpoint_get_str(cf, &w->file_arena);
+    for (int i = 0; i < WALK_CHECKPOINT_DATA; i++)
+        w->resumed_data[i] = checkpoint_get(cf);
+    get_report(cf, &w->report);
+    w->root_dev = (dev_t)checkpoint_get(cf);
+    uint64_t sp = checkpoint_get(cf);
+    if (sp < 1 || sp > MAX_DEPTH) checkpoint_reject(cf);
+    for (uint64_t d = 0; d <= sp && !checkpoint_bad(cf); d++)
+        w->ancestor_siblings[d] = checkpoint_get(cf);
+    for (; w->sp < (int)sp && !checkpoint_bad(cf); w->sp++)
+        w->stack[w->sp] = get_frame(cf, w, w->sp);
+
+    if (keeps_visited(opts)) w->visited = create_visited_node_hash(opts->expect_dirs);
+    if (opts->dedup_links) w->linked = create_visited_node_hash(0);
+    get_set(cf, w->visited);
+    get_set(cf, w->linked);
+    if (!checkpoint_close(cf)) {
+        walk_free(w);
+        errno = 0;
+        return NULL;
+    }
+
+    // Paths are as the walk printed them: relative ones only lead back from where it ran
+    char cwd[PATH_MAX];
+    bool relative = w->stack[0]->path[0] != '/';
+    if (!same_options || (relative && (!started_in || !getcwd(cwd, sizeof(cwd)) || strcmp(cwd, started_in)))) {
+        if (!same_options) fprintf(stderr, "%s was saved by a walk with other options\n", file);
+        else fprintf(stderr, "%s: resume in %s, where the walk was started\n", file,
+                     started_in ? started_in : "the same directory");
+        walk_free(w);
+        errno = 0;
+        return NULL;
+    }
+    arena_reset(&w->file_arena);
+    w->root_path = copy_string(w->stack[0]->path);
+
+    if (opts->parallel > 0) {
+        w->pool = scan_pool_create(opts->parallel, opts);
+        if (opts->one_file_system) scan_pool_limit_device(w->pool, w->root_dev);
+    }
+    if (opts->follow_links && !w->visited && !opts->no_link_targets) w->links = create_link_targets();
+    if (opts->checkpoint) w->checkpoint_due = timing_now() + (uint64_t)opts->checkpoint_ms * 1000000u;
+    return w;
+}
+
+const uint64_t *walk_resumed(const Walk *w) {
+    return w->resumed ? w->resumed_data : NULL;
+}
+
+// ------------------ Main traversal loop ------------------
+bool walk_run(Walk *w) {
+    if (w->opts->breadth_first) walk_levels(w);
+
+    // Loop continues while there are frames (directories) on the stack
+    while (w->sp > 0) {
+        DirFrame *frame = w->stack[w->sp - 1]; // peek at top of stack
+
+        // Directory listing and files are reported once, straight after the scan
+        if (!frame->printed) {
+            scan_top(w, frame);
+            enter_top(w, frame);
+            if (w->checkpoint_due && timing_now() >= w->checkpoint_due) {
+                save_checkpoint(w);
+                w->checkpoint_due = timing_now() + (uint64_t)w->opts->checkpoint_ms * 1000000u;
+            }
+        }
+
+        if (frame->current < frame->subdir_count) {
+            next_subdir(w, frame);
+        } else {
+            // Directory fully processed: pop and clean up
+            DirFrame *parent = w->sp > 1 ? w->stack[w->sp - 2] : NULL;
+            if (w->opts->du || w->opts->top) subtree_finish(frame, parent);
+            VISIT(w, leave_dir, frame, parent);
+            Free_Frame(frame, &w->fds, w->pool);
+            w->sp--;
+        }
+    }
+
+    if (w->pool) {
+        w->report.TOTAL_peak_fds += scan_pool_peak_fds(w->pool);
+        scan_pool_destroy(w->pool);
+        w->pool = NULL;
+    }
+    // Done: there is nothing left to resume
+    if (w->opts->checkpoint) unlink(w->opts->checkpoint);
+    if (w->snap && w->record) {
+        w->kept = snapshot_take(w->snap);
+        w->snap = NULL;
+        return w->kept != NULL;
+    }
+    if (w->snap) {
+        w->snap_entries = snapshot_finish(w->snap);
+        w->snap = NULL;
+        return w->snap_entries >= 0;
+    }
+    return true;
+}
+
+Snapshot *walk_take_snapshot(Walk *w) {
+    Snapshot *s = w->kept;
+    w->kept = NULL;
+    return s;
+}
+
+const ActivityReport *walk_report(const Walk *w) {
+    return &w->report;
+}
+
+long walk_snapshot_entries(const Walk *w) {
+    return w->snap_entries;
+}
+
+// ----------------- Clean up -----------------
+// Normally after walk_run(); a walk stopped early still has frames to release
+void walk_free(Walk *w) {
+    while (w->sp > 0)
+        Free_Frame(w->stack[--w->sp], &w->fds, w->pool);
+    if (w->pool) scan_pool_destroy(w->pool);
+    if (!w->lent_visited) free_visited_node_hash(w->visited); // free memory for loop-detection hash
+    free_visited_node_hash(w->linked);
+    free_link_targets(w->links);
+    if (w->own_since) snapshot_unload(w->since);
+    if (w->kept) snapshot_unload(w->kept);
+    if (w->snap) snapshot_discard(w->snap);
+    for (int i = 0; i < MAX_DEPTH + 2; i++)
+        arena_free(&w->arenas[i]);
+    arena_free(&w->file_arena);
+    free(w->root_path);
+    free(w);
+}
@@ -0,0 +1,95 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/stat.h>   // For struct stat
+#include "gtree.h"
+#include "option_parsing.h"
+#include "snapshot.h"
+#include "visit_hash.h"
+
+// -------------------- The traversal (libgtree) --------------------
+// One walk of a directory tree, as the gtree command does it, reporting what it
+// finds to a visitor instead of printing. Everything a walk uses (stack, arenas,
+// fd budget, visited set, scan pool, snapshots) is in its Walk, so several walks can
+// run in one process, each on its own thread. The command's tree printer (gtree.c)
+// is one visitor; make builds every module but gtree.c into libgtree.a.
+//
+// Events arrive in walk order on the thread calling walk_run(). With --breadth-first
+// that is level order: a directory's enter_dir comes after all of its parent's subdir
+// events, and its leave_dir (parent NULL) right after its own. The frames passed are
+// only valid during the call; the strings in them live until the directory is left
+// (leave_dir has returned). Any callback may be NULL.
+
+// A subdirectory (or symlink to one) reached in Phase 2, before it is entered
+typedef struct WalkEntry {
+    const DirFrame *dir;        // path/depth/tree branch state for printing it; NULL for a
+                                // plain directory about to be entered (enter_dir has its frame)
+    const SubDirNode *node;     // name, is_symlink and sym_path from the Phase 1 scan
+    bool is_last;               // The last subdirectory of its parent
+    const struct stat *st;      // The (followed) directory's stat, or NULL if that failed (or
+                                // was skipped: a plain directory at the depth limit, only listed)
+    bool recursive;             // Already visited: entering it again would loop
+    bool enter;                 // The walk will now try to enter it
+} WalkEntry;
+
+#define WALK_CHECKPOINT_DATA 4     // Visitor state kept in a checkpoint
+
+typedef struct WalkVisitor {
+    void *ctx;                  // Passed to every callback
+    // A directory has been read: dir->subfiles holds its files if they were asked for
+    // (-f, --top), dir_file_count/size its totals. Its subdirectories follow.
+    void (*enter_dir)(void *ctx, const DirFrame *dir);
+    // Each file of the directory just entered, in print order (after enter_dir)
+    void (*file)(void *ctx, const DirFrame *dir, const SubDirFile *f);
+    // A subdirectory of parent, in order; enter_dir follows if entry->enter and it opens
+    void (*subdir)(void *ctx, const DirFrame *parent, const WalkEntry *entry);
+    // entry (entry->enter was set) could not be opened; err is the errno
+    void (*enter_failed)(void *ctx, const DirFrame *parent, const WalkEntry *entry, int err);
+    // A directory and everything below it are done; tree_* totals are final with --du/--top
+    void (*leave_dir)(void *ctx, const DirFrame *dir, const DirFrame *parent);
+    // A directory that had been entered could not be read (or reopened) any further
+    void (*error)(void *ctx, const char *path, int err);
+    // --checkpoint is about to be saved: whatever was reported so far has to be out for
+    // good. data goes in the checkpoint, and walk_resumed() hands it back.
+    void (*checkpoint)(void *ctx, uint64_t data[WALK_CHECKPOINT_DATA]);
+} WalkVisitor;
+
+typedef struct Walk Walk;
+
+// Opens root_path and prepares a walk of it with opts. opts and visitor must outlive
+// the walk. Returns NULL with errno set if root_path can't be opened, or if the
+// --since snapshot can't be loaded (after saying why on stderr, with errno 0).
+Walk *walk_create(const char *root_path, const Options *opts, const WalkVisitor *visitor);
+// As walk_create(), but the walk also keeps everything it reports as a snapshot in
+// memory, for walk_take_snapshot(), and reuses the unchanged listings of since (which
+// it only borrows) instead of those of --since. For --watch: if since is trusted
+// (snapshot_trust), subtrees nothing changed in are copied from it without being
+// opened or reported, and the walk's totals leave them out but for TOTAL_dirs_reused.
+Walk *walk_create_recorded(const char *root_path, const Options *opts, const WalkVisitor *visitor,
+                           Snapshot *since);
+// As walk_create(), but if opts has the walk keep a visited set it uses visited
+// (from create_shared_visited(), which it only borrows): walks of other roots running
+// at the same time skip the directories it has reached, and it skips theirs. A
+// directory two of them reach at the same moment is walked by one of them only.
+Walk *walk_create_shared(const char *root_path, const Options *opts, const WalkVisitor *visitor,
+                         VisitedSet *visited);
+// Carries on with the walk saved in --checkpoint file, which opts must match (the
+// directory it was started in too, for a relative root). Returns NULL with errno 0,
+// after saying why on stderr, if file can't be read or doesn't fit.
+Walk *walk_resume(const char *file, const Options *opts, const WalkVisitor *visitor);
+// Walks the whole tree. Returns false if --save-snapshot could not be written (or the
+// recorded snapshot kept).
+bool walk_run(Walk *w);
+// The recorded walk (after walk_run); the caller unloads it
+Snapshot *walk_take_snapshot(Walk *w);
+// Totals of the walk so far (complete after walk_run)
+const ActivityReport *walk_report(const Walk *w);
+// What the visitor gave the checkpoint a resumed walk started from, else NULL
+const uint64_t *walk_resumed(const Walk *w);
+// Entries written by --save-snapshot (after walk_run)
+long walk_snapshot_entries(const Walk *w);
+void walk_free(Walk *w);
+
+#endif
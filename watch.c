@@ -0,0 +1,239 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>      // For errno, ENOSPC, EAGAIN
+#include <time.h>       // For nanosleep
+#include <unistd.h>     // For read, close (POSIX)
+#include "gtree.h"
+#include "option_parsing.h"
+#include "output.h"
+#include "snapshot.h"
+#include "timing.h"
+#include "walk.h"
+#include "watch.h"
+#ifdef __linux__
+#include <poll.h>           // For poll
+#include <sys/inotify.h>    // For inotify_init1, inotify_add_watch
+#include "khashl.h"
+#endif
+
+// ----------------- Walk events -----------------
+// A watched walk prints nothing while it runs; only its errors are reported
+static void watch_enter_failed(void *ctx, const DirFrame *parent, const WalkEntry *e, int err) {
+    (void)ctx;
+    (void)parent;
+    (void)e;
+    errno = err;
+    out_perror("opendir");
+}
+
+static void watch_error(void *ctx, const char *path, int err) {
+    (void)ctx;
+    (void)path;
+    errno = err;
+    out_perror("opendir");
+}
+
+static const WalkVisitor watch_visitor = {
+    .enter_failed = watch_enter_failed,
+    .error = watch_error,
+};
+
+static void sleep_ms(int ms) {
+    struct timespec t = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&t, NULL);
+}
+
+#ifdef __linux__
+// ----------------- inotify -----------------
+// One watch per directory the tree holds a listing of. Events name the watch, so
+// each is mapped back to its directory, whose listing the next walk must not reuse:
+// a file in it may have changed size without touching the directory's mtime. With
+// every directory watched, the next walk takes the subtrees no event named a
+// directory of from the kept tree whole, so it only opens the changed directories
+// and the ones above them.
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | \
+                      IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct { dev_t dev; ino_t ino; } DirKey;
+
+static inline khint_t dir_key_hash(DirKey k) {
+    return kh_hash_uint64(((uint64_t)k.dev * 11400714819323198485ULL) ^ (uint64_t)k.ino);
+}
+static inline int dir_key_equal(DirKey a, DirKey b) {
+    return a.dev == b.dev && a.ino == b.ino;
+}
+KHASHL_MAP_INIT(static kh_inline klib_unused, wd_dirs, wd_dirs, int, DirKey, kh_hash_uint32, kh_eq_generic)
+KHASHL_MAP_INIT(static kh_inline klib_unused, dir_wds, dir_wds, DirKey, int, dir_key_hash, dir_key_equal)
+
+typedef struct Watcher {
+    int fd;                 // inotify instance, -1 if there is none (the tree is polled)
+    wd_dirs *by_wd;         // watch descriptor -> directory
+    dir_wds *by_dir;        // directory -> watch descriptor
+    Snapshot *tree;         // The tree being watched (watch_tree)
+    bool full;              // max_user_watches reached: the rest of the tree isn't watched
+    bool overflow;          // Events were lost: the next walk has to read everything
+} Watcher;
+
+static void watcher_init(Watcher *wt) {
+    *wt = (Watcher){0};
+    wt->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (wt->fd == -1) {
+        perror("inotify_init1");
+        return;
+    }
+    wt->by_wd = wd_dirs_init();
+    wt->by_dir = dir_wds_init();
+}
+
+static void watcher_free(Watcher *wt) {
+    if (wt->fd == -1) return;
+    close(wt->fd);
+    wd_dirs_destroy(wt->by_wd);
+    dir_wds_destroy(wt->by_dir);
+}
+
+// Called for every directory of a new tree; only the ones not watched yet cost a call.
+// Those were read before their watch existed, or aren't watched at all: the next walk
+// checks them itself.
+static void watch_dir(void *ctx, const char *path, dev_t dev, ino_t ino) {
+    Watcher *wt = ctx;
+    DirKey key = { dev, ino };
+    if (dir_wds_get(wt->by_dir, key) != kh_end(wt->by_dir)) return;
+    snapshot_recheck(wt->tree, dev, ino);
+    if (wt->full) return;
+
+    int wd = inotify_add_watch(wt->fd, path, WATCH_EVENTS | IN_ONLYDIR);
+    if (wd == -1) {
+        if (errno == ENOSPC) {
+            wt->full = true;
+            fprintf(stderr, "inotify watch limit reached (fs.inotify.max_user_watches): "
+                            "changes below %s and later directories are not seen\n", path);
+        }
+        return;     // Gone again or unreadable: the next walk will tell
+    }
+    int absent;
+    khint_t k = dir_wds_put(wt->by_dir, key, &absent);
+    kh_val(wt->by_dir, k) = wd;
+    k = wd_dirs_put(wt->by_wd, wd, &absent);
+    kh_val(wt->by_wd, k) = key;
+}
+
+static void watch_tree(Watcher *wt, Snapshot *tree) {
+    if (wt->fd == -1) return;
+    wt->tree = tree;
+    snapshot_each_dir(tree, watch_dir, wt);
+    snapshot_trust(tree);
+}
+
+// Drain the queued events, marking the directories they name as changed
+static void read_events(Watcher *wt, Snapshot *tree) {
+    char buf[16 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(wt->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->mask & IN_Q_OVERFLOW) {
+                wt->overflow = true;
+                continue;
+            }
+            khint_t k = wd_dirs_get(wt->by_wd, ev->wd);
+            if (k == kh_end(wt->by_wd)) continue;
+            DirKey key = kh_val(wt->by_wd, k);
+            if (ev->mask & IN_IGNORED) {
+                // The directory is gone (or was unmounted): so is its watch
+                wd_dirs_del(wt->by_wd, k);
+                khint_t d = dir_wds_get(wt->by_dir, key);
+                if (d != kh_end(wt->by_dir)) dir_wds_del(wt->by_dir, d);
+            }
+            if (tree) snapshot_invalidate(tree, key.dev, key.ino);
+        }
+    }
+}
+
+// Block until something changes, then collect whatever else changes in the next ms,
+// so a burst of changes costs one walk
+static void wait_for_changes(Watcher *wt, Snapshot *tree, int ms) {
+    if (wt->fd == -1) {
+        sleep_ms(ms);
+        return;
+    }
+    struct pollfd p = { .fd = wt->fd, .events = POLLIN };
+    while (poll(&p, 1, -1) == -1 && errno == EINTR)
+        ;
+    uint64_t end = timing_now() + (uint64_t)ms * 1000000u;
+    for (;;) {
+        read_events(wt, tree);
+        uint64_t now = timing_now();
+        if (now >= end) break;
+        poll(&p, 1, (int)((end - now) / 1000000u) + 1);
+    }
+}
+#else
+// ----------------- Polling -----------------
+// No change notification: every ms the tree is walked again, which re-reads only the
+// directories whose mtime/ctime moved (file size changes alone aren't seen)
+typedef struct Watcher {
+    int fd;
+    bool overflow;
+} Watcher;
+
+static void watcher_init(Watcher *wt) { *wt = (Watcher){ .fd = -1 }; }
+static void watcher_free(Watcher *wt) { (void)wt; }
+static void watch_tree(Watcher *wt, Snapshot *tree) { (void)wt; (void)tree; }
+static void wait_for_changes(Watcher *wt, Snapshot *tree, int ms) {
+    (void)wt;
+    (void)tree;
+    sleep_ms(ms);
+}
+#endif
+
+// ----------------- The watch loop -----------------
+bool watch_run(const char *root_path, const Options *opts, WatchRender render, void *ctx) {
+    // Every walk records the files too: the render counts and lists them from the tree
+    Options walk_opts = *opts;
+    walk_opts.show_files = true;
+
+    Watcher wt;
+    watcher_init(&wt);
+    Snapshot *tree = NULL;
+    bool ok = true;
+
+    for (bool first = true; ok; first = false) {
+        uint64_t start = timing_now();
+        Walk *w = walk_create_recorded(root_path, &walk_opts, &watch_visitor, tree);
+        if (!w) {
+            ok = false;
+            break;
+        }
+        ok = walk_run(w);
+        Snapshot *next = walk_take_snapshot(w);
+        ActivityReport walked = *walk_report(w);
+        walk_free(w);
+        if (tree) snapshot_unload(tree);
+        tree = next;
+        if (!ok) {
+            errno = 0;
+            break;
+        }
+
+        // Nothing re-read (only possible when polling): the tree is as shown
+        if (first || walked.TOTAL_dirs_reread)
+            render(ctx, tree, &walked, timing_now() - start);
+
+        watch_tree(&wt, tree);
+        wait_for_changes(&wt, tree, opts->watch_ms);
+        if (wt.overflow) {
+            snapshot_unload(tree);
+            tree = NULL;
+            wt.overflow = false;
+        }
+    }
+
+    int err = errno;
+    if (tree) snapshot_unload(tree);
+    watcher_free(&wt);
+    errno = err;
+    return false;
+}
@@ -0,0 +1,28 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "gtree.h"
+#include "option_parsing.h"
+#include "snapshot.h"
+
+// -------------------- Live trees (--watch) --------------------
+// Walks root_path once, keeping the result as a snapshot in memory, and then stays
+// resident: whenever the tree changes the walk is repeated with the kept snapshot
+// as --since, so only directories that changed are read again, and the new tree is
+// handed to render. On Linux inotify says when and in which directories something
+// changed, and the walk copies every subtree without such a directory from the kept
+// one, opening only the changed directories and those above them; elsewhere the
+// tree is re-checked every opts->watch_ms.
+
+// Called with the tree to show after each walk that found something new; walked
+// holds the walk's totals (TOTAL_dirs_reread/reused), walk_ns how long it took
+typedef void (*WatchRender)(void *ctx, const Snapshot *tree, const ActivityReport *walked,
+                            uint64_t walk_ns);
+
+// Only returns if a walk fails: false with errno set if root_path can't be opened,
+// or with errno 0 once the reason has been printed
+bool watch_run(const char *root_path, const Options *opts, WatchRender render, void *ctx);
+
+#endif